@@ -28,9 +28,11 @@
 #include<linux/kthread.h>
 #include<linux/sched.h>
 #include<linux/delay.h>
+#include <linux/jump_label.h>
 
 #include "val/common/include/pal_interface.h"
 #include "val/bsa/include/bsa_pal_interface.h"
+#include "common/include/pal_msg.h"
 
 #define PAL_LINUX_SUCCESS  0x0
 #define PAL_LINUX_ERR  0xEDCB1234  //some impropable value?
@@ -57,31 +59,56 @@ uint64_t pal_get_mcfg_ptr(void);
 
 uint64_t pal_get_madt_ptr(void);
 
-#define MIN_NUM_MSG 20
-#define NUM_MSG_GROW(n) n*2
-typedef struct __PAL_BSA_MSG__ {
-    char string[92];
-    unsigned long data;
-}pal_msg_parms_t;
-
 #define MSG_SIZE sizeof(pal_msg_parms_t)
 
-extern char *g_msg_buf;
-extern int tail_msg;
-extern int num_msg;
+/* Longest message pal_print emits, longer ones are truncated */
+#define PAL_PRINT_BUF_SIZE 256
 
 extern uint32_t g_print_level;
 
 int pal_smmu_check_dev_attach(struct device *dev);
 
+/* Bytes needed by an info table holding n entries in its trailing array,
+   rounded up to the 16 byte alignment the drv keeps its tables at */
+#define PAL_INFO_TABLE_SIZE(type, array, n) \
+        ALIGN(offsetof(type, array) + (n) * sizeof(((type *)0)->array[0]), 16)
+
+/* Sizing passes run before each info table is built. 0 means the size is
+   not known up front and the drv falls back to its fixed table size. */
+uint32_t pal_pe_info_table_size(void);
+uint32_t pal_pcie_info_table_size(void);
+uint32_t pal_peripheral_info_table_size(void);
+uint32_t pal_dma_info_table_size(void);
+uint32_t pal_iovirt_info_table_size(void);
+
+/* A table the drv has filled from a snapshot. The create call VAL makes on
+   it next keeps the content instead of discovering it again, so VAL sets
+   up its own state on top of the table as after a discovery. */
+void pal_info_table_import(void *table);
+bool pal_info_table_imported(void *table);
+
 #define ACS_PRINT_ERR   5      /* Only Errors. use this to de-clutter the terminal and focus only on specifics */
 #define ACS_PRINT_WARN  4      /* Only warnings & errors. use this to de-clutter the terminal and focus only on specifics */
 #define ACS_PRINT_TEST  3      /* Test description and result descriptions. THIS is DEFAULT */
 #define ACS_PRINT_DEBUG 2      /* For Debug statements. contains register dumps etc */
 #define ACS_PRINT_INFO  1      /* Print all statements. Do not use unless really needed */
 
+/* Prints below ACS_PRINT_FLOOR are compiled out, e.g. build with
+   ACS_PRINT_FLOOR=ACS_PRINT_TEST for production runs */
+#ifndef ACS_PRINT_FLOOR
+#define ACS_PRINT_FLOOR ACS_PRINT_INFO
+#endif
+
+/* One static key per verbosity, enabled when it is at or above
+   g_print_level. Kept in sync by pal_print_set_level(). */
+extern struct static_key_false g_print_enabled[ACS_PRINT_ERR + 1];
+
+void pal_print_set_level(uint32_t level);
+
 #define acs_print(verbosity, string, data) \
-                                 if(verbosity >= g_print_level) {  \
-                                     pal_print(string, data);  \
-                                 }
+                                 do { \
+                                     if ((verbosity) >= ACS_PRINT_FLOOR && \
+                                         static_branch_unlikely(&g_print_enabled[verbosity])) \
+                                         pal_print(string, data);  \
+                                 } while (0)
 #endif
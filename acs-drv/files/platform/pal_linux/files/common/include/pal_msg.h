@@ -0,0 +1,109 @@
+/*
+ * BSA SBSA ACS Platform module.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2024 Arm Limited
+ *
+ */
+
+#ifndef __PAL_MSG_H__
+#define __PAL_MSG_H__
+
+#include <linux/types.h>
+#include <linux/fs.h>
+#include <linux/poll.h>
+
+/* Record handed to the user application through the msg interface */
+typedef struct __PAL_BSA_MSG__ {
+    char string[92];
+    unsigned long data;
+}pal_msg_parms_t;
+
+/* Records buffered per CPU, must be a power of two */
+#define PAL_MSG_RING_SIZE 256
+
+/* Shared results ring exported through the mmap-able /dev/<name> device.
+ *
+ * The device is laid out as one page holding pal_msg_shm_hdr_t, one page
+ * holding the consumer index (tail_offset) and then num_records records in
+ * the pal_msg_parms_t layout (version 1) at records_offset. Only the tail
+ * page may be mapped writable; the header and records are read-only.
+ *
+ * The driver publishes records by advancing head; record n lives at index
+ * n % num_records. The application consumes records [tail, head), stores
+ * the new tail and then polls the device, which refills the ring and
+ * signals POLLIN once head moves past tail. head and tail only ever increase.
+ */
+#define PAL_MSG_SHM_MAGIC     0x4D534341  /* "ACSM" */
+#define PAL_MSG_SHM_VERSION   1
+#define PAL_MSG_SHM_RECORDS   4096        /* must be a power of two */
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t num_records;
+    uint64_t records_offset;  /* offset of record 0 from the start of the device */
+    uint64_t tail_offset;     /* offset of the uint64_t tail written by the application */
+    uint64_t dropped;         /* records lost because a ring was full */
+    uint8_t  reserved0[24];
+    uint64_t head;            /* offset 64, written by the driver */
+}pal_msg_shm_hdr_t;
+
+/* Binary result record, emitted once per executed command next to the
+ * text stream. test_id is 0 for a record that covers a whole module.
+ */
+#define PAL_RESULT_PASS  0
+#define PAL_RESULT_FAIL  1
+#define PAL_RESULT_SKIP  2
+
+/* Result records buffered until read, must be a power of two */
+#define PAL_RESULT_FIFO_SIZE 256
+
+typedef struct __PAL_RESULT__ {
+    uint32_t module;      /* execute command that ran, e.g. BSA_PCIE_EXECUTE_TEST */
+    uint32_t test_id;
+    uint32_t status;      /* PAL_RESULT_PASS/FAIL/SKIP */
+    uint32_t pe;          /* logical CPU the command was driven from */
+    uint32_t error;       /* VAL status word of the run */
+    uint32_t tests_run;
+    uint32_t tests_pass;
+    uint32_t tests_fail;
+    uint64_t start_ns;    /* ktime_get_ns() at start and end of the run */
+    uint64_t end_ns;
+}pal_result_t;
+
+int pal_msg_init(const char *name);
+
+void pal_msg_exit(void);
+
+void pal_msg_reset(void);
+
+void pal_msg_set_active(bool active);
+
+void pal_msg_put(const char *string, uint64_t data);
+
+void pal_msg_put_deferred(const char *fmt, uint64_t data);
+
+ssize_t pal_msg_read(struct file *file, char __user *buf, size_t size);
+
+__poll_t pal_msg_poll(struct file *file, poll_table *wait);
+
+uint64_t pal_msg_dropped(void);
+
+void pal_msg_result_put(const pal_result_t *result);
+
+ssize_t pal_msg_result_read(char __user *buf, size_t size);
+
+#endif /* __PAL_MSG_H__ */
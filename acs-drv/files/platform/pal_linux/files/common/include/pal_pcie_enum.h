@@ -34,6 +34,43 @@
 struct pci_dev *
 pal_pci_get_dev(unsigned int class_code, struct pci_dev *dev);
 
+struct pci_dev *
+pal_pci_dev_get(uint32_t seg, uint32_t bus, uint32_t dev, uint32_t fn);
+
+void
+pal_pci_dev_cache_add(struct pci_dev *pdev);
+
+void
+pal_pci_dev_cache_del(struct pci_dev *pdev);
+
+void
+pal_pci_dev_cache_fill(void);
+
+void
+pal_pci_dev_cache_free(void);
+
+int
+pal_pci_cfg_cache_read(struct pci_dev *pdev, uint32_t offset, uint32_t len, uint32_t *val);
+
+void
+pal_pci_cfg_cache_invalidate(uint32_t bdf);
+
+int
+pal_pci_find_ext_cap(struct pci_dev *pdev, uint32_t cap_id);
+
+void
+pal_pcie_ecam_map(void);
+
+void
+pal_pcie_ecam_unmap(void);
+
+int
+pal_pcie_ecam_read(uint32_t seg, uint32_t bus, uint32_t devfn, uint32_t offset,
+                   uint32_t len, uint32_t *val);
+
+int
+pal_pcie_ecam_read_cfg_space(uint32_t seg, uint32_t bus, uint32_t devfn, uint8_t *buf, uint32_t size);
+
 struct pci_dev *
 pal_pci_get_dev_next (struct pci_dev *from_dev);
 
@@ -0,0 +1,277 @@
+/*
+ * BSA SBSA ACS Platform module.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2024 Arm Limited
+ *
+ */
+
+/* Tracepoints for ACS runs and the PAL hardware accesses made on their
+ * behalf. The events show up under events/acs/ in tracefs and cost a
+ * patched-out branch while disabled.
+ *
+ * pal_misc.c instantiates them with CREATE_TRACE_POINTS, every other user
+ * just includes this header.
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM acs
+
+#if !defined(__PAL_TRACE_H__) || defined(TRACE_HEADER_MULTI_READ)
+#define __PAL_TRACE_H__
+
+#include <linux/types.h>
+#include <linux/tracepoint.h>
+
+/* One command written to /proc/<bsa|sbsa> by the user application. The end
+ * event carries arg1 as handed back to it, the status of execute commands.
+ */
+TRACE_EVENT(acs_cmd_begin,
+
+    TP_PROTO(uint32_t api_num, uint32_t level, uint32_t num_pe),
+
+    TP_ARGS(api_num, level, num_pe),
+
+    TP_STRUCT__entry(
+        __field(uint32_t, api_num)
+        __field(uint32_t, level)
+        __field(uint32_t, num_pe)
+    ),
+
+    TP_fast_assign(
+        __entry->api_num = api_num;
+        __entry->level   = level;
+        __entry->num_pe  = num_pe;
+    ),
+
+    TP_printk("api=%u level=%u num_pe=%u",
+              __entry->api_num, __entry->level, __entry->num_pe)
+);
+
+TRACE_EVENT(acs_cmd_end,
+
+    TP_PROTO(uint32_t api_num, uint64_t status),
+
+    TP_ARGS(api_num, status),
+
+    TP_STRUCT__entry(
+        __field(uint32_t, api_num)
+        __field(uint64_t, status)
+    ),
+
+    TP_fast_assign(
+        __entry->api_num = api_num;
+        __entry->status  = status;
+    ),
+
+    TP_printk("api=%u status=0x%llx", __entry->api_num, __entry->status)
+);
+
+/* One VAL test module (PCIe, peripheral, memory, ...) run by a command */
+TRACE_EVENT(acs_module_begin,
+
+    TP_PROTO(uint32_t module, uint32_t num_pe),
+
+    TP_ARGS(module, num_pe),
+
+    TP_STRUCT__entry(
+        __field(uint32_t, module)
+        __field(uint32_t, num_pe)
+    ),
+
+    TP_fast_assign(
+        __entry->module = module;
+        __entry->num_pe = num_pe;
+    ),
+
+    TP_printk("module=%u num_pe=%u", __entry->module, __entry->num_pe)
+);
+
+TRACE_EVENT(acs_module_end,
+
+    TP_PROTO(uint32_t module, uint32_t status, uint32_t tests_run,
+             uint32_t tests_pass, uint32_t tests_fail),
+
+    TP_ARGS(module, status, tests_run, tests_pass, tests_fail),
+
+    TP_STRUCT__entry(
+        __field(uint32_t, module)
+        __field(uint32_t, status)
+        __field(uint32_t, tests_run)
+        __field(uint32_t, tests_pass)
+        __field(uint32_t, tests_fail)
+    ),
+
+    TP_fast_assign(
+        __entry->module     = module;
+        __entry->status     = status;
+        __entry->tests_run  = tests_run;
+        __entry->tests_pass = tests_pass;
+        __entry->tests_fail = tests_fail;
+    ),
+
+    TP_printk("module=%u status=%u run=%u pass=%u fail=%u",
+              __entry->module, __entry->status, __entry->tests_run,
+              __entry->tests_pass, __entry->tests_fail)
+);
+
+DECLARE_EVENT_CLASS(acs_mmio,
+
+    TP_PROTO(uint64_t addr, uint32_t width, uint64_t data),
+
+    TP_ARGS(addr, width, data),
+
+    TP_STRUCT__entry(
+        __field(uint64_t, addr)
+        __field(uint32_t, width)
+        __field(uint64_t, data)
+    ),
+
+    TP_fast_assign(
+        __entry->addr  = addr;
+        __entry->width = width;
+        __entry->data  = data;
+    ),
+
+    TP_printk("addr=0x%llx width=%u data=0x%llx",
+              __entry->addr, __entry->width, __entry->data)
+);
+
+DEFINE_EVENT(acs_mmio, acs_mmio_read,
+    TP_PROTO(uint64_t addr, uint32_t width, uint64_t data),
+    TP_ARGS(addr, width, data)
+);
+
+DEFINE_EVENT(acs_mmio, acs_mmio_write,
+    TP_PROTO(uint64_t addr, uint32_t width, uint64_t data),
+    TP_ARGS(addr, width, data)
+);
+
+/* Config space accesses made by the PAL, through the kernel PCI accessors
+ * or its direct ECAM path. Reads answered from the config space snapshot
+ * cache are reported as acs_cfg_read_cached, without touching the device.
+ * ECAM accesses made by VAL are reported as acs_mmio events.
+ */
+DECLARE_EVENT_CLASS(acs_cfg,
+
+    TP_PROTO(uint32_t bdf, uint32_t offset, uint32_t width, uint32_t data),
+
+    TP_ARGS(bdf, offset, width, data),
+
+    TP_STRUCT__entry(
+        __field(uint32_t, bdf)
+        __field(uint32_t, offset)
+        __field(uint32_t, width)
+        __field(uint32_t, data)
+    ),
+
+    TP_fast_assign(
+        __entry->bdf    = bdf;
+        __entry->offset = offset;
+        __entry->width  = width;
+        __entry->data   = data;
+    ),
+
+    TP_printk("bdf=0x%x offset=0x%x width=%u data=0x%x",
+              __entry->bdf, __entry->offset, __entry->width, __entry->data)
+);
+
+DEFINE_EVENT(acs_cfg, acs_cfg_read,
+    TP_PROTO(uint32_t bdf, uint32_t offset, uint32_t width, uint32_t data),
+    TP_ARGS(bdf, offset, width, data)
+);
+
+DEFINE_EVENT(acs_cfg, acs_cfg_read_cached,
+    TP_PROTO(uint32_t bdf, uint32_t offset, uint32_t width, uint32_t data),
+    TP_ARGS(bdf, offset, width, data)
+);
+
+DEFINE_EVENT(acs_cfg, acs_cfg_write,
+    TP_PROTO(uint32_t bdf, uint32_t offset, uint32_t width, uint32_t data),
+    TP_ARGS(bdf, offset, width, data)
+);
+
+/* A block of config space read in one go to fill the snapshot cache */
+TRACE_EVENT(acs_cfg_read_bulk,
+
+    TP_PROTO(uint32_t bdf, uint32_t offset, uint32_t size),
+
+    TP_ARGS(bdf, offset, size),
+
+    TP_STRUCT__entry(
+        __field(uint32_t, bdf)
+        __field(uint32_t, offset)
+        __field(uint32_t, size)
+    ),
+
+    TP_fast_assign(
+        __entry->bdf    = bdf;
+        __entry->offset = offset;
+        __entry->size   = size;
+    ),
+
+    TP_printk("bdf=0x%x offset=0x%x size=%u",
+              __entry->bdf, __entry->offset, __entry->size)
+);
+
+TRACE_EVENT(acs_irq_install,
+
+    TP_PROTO(uint32_t int_id, uint32_t virq, int ret),
+
+    TP_ARGS(int_id, virq, ret),
+
+    TP_STRUCT__entry(
+        __field(uint32_t, int_id)
+        __field(uint32_t, virq)
+        __field(int, ret)
+    ),
+
+    TP_fast_assign(
+        __entry->int_id = int_id;
+        __entry->virq   = virq;
+        __entry->ret    = ret;
+    ),
+
+    TP_printk("int_id=%u virq=%u ret=%d",
+              __entry->int_id, __entry->virq, __entry->ret)
+);
+
+TRACE_EVENT(acs_irq_fire,
+
+    TP_PROTO(uint32_t int_id, uint32_t virq),
+
+    TP_ARGS(int_id, virq),
+
+    TP_STRUCT__entry(
+        __field(uint32_t, int_id)
+        __field(uint32_t, virq)
+    ),
+
+    TP_fast_assign(
+        __entry->int_id = int_id;
+        __entry->virq   = virq;
+    ),
+
+    TP_printk("int_id=%u virq=%u", __entry->int_id, __entry->virq)
+);
+
+#endif /* __PAL_TRACE_H__ */
+
+/* Resolved through the common/include search path of the PAL Makefiles */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE pal_trace
+
+#include <trace/define_trace.h>
@@ -94,6 +94,37 @@ pal_dma_mem_free(void *buffer, addr_t mem_dma, unsigned int length, void *port,
 }
 
 
+/* Controllers the table was last sized for, 0 if it was not sized */
+static unsigned int g_dma_table_max;
+
+/* Counts the devices behind ATA hosts the same way the create pass walks
+   them, to size the DMA info table */
+uint32_t
+pal_dma_info_table_size(void)
+{
+	struct Scsi_Host   *shost;
+	struct ata_port    *ap;
+	struct scsi_device *sdev;
+	unsigned int i = 0, num_ctrls = 0;
+
+	do {
+		shost = scsi_host_lookup(i++);
+		if (shost) {
+			ap = ata_shost_to_port(shost);
+			if (ap && ap->dev && ap->scsi_host == shost) {
+				shost_for_each_device(sdev, shost)
+					num_ctrls++;
+			}
+			scsi_host_put(shost);
+		}
+	} while(shost);
+
+	/* Keep room for one entry so an empty table is still valid memory */
+	g_dma_table_max = max(num_ctrls, 1u);
+
+	return PAL_INFO_TABLE_SIZE(DMA_INFO_TABLE, info, g_dma_table_max);
+}
+
 void
 pal_dma_create_info_table(DMA_INFO_TABLE *dma_info_table)
 {
@@ -117,6 +148,10 @@ pal_dma_create_info_table(DMA_INFO_TABLE *dma_info_table)
 			do {
 				/* get the device connected to this host */
 				sdev = __scsi_iterate_devices(shost, sdev);
+				if (sdev && g_dma_table_max && j == g_dma_table_max) {
+					scsi_device_put(sdev);
+					break;
+				}
 				if (sdev) {
 					dma_info_table->info[j].host   = shost;
 					dma_info_table->info[j].port   = ap;
@@ -22,6 +22,71 @@
 #include <linux/version.h>
 #include <linux/irqdomain.h>
 #include <linux/interrupt.h>
+#include <linux/radix-tree.h>
+#include <linux/spinlock.h>
+#include "common/include/pal_trace.h"
+
+/* ISR registered by VAL for a virq. Requests go through pal_gic_isr so
+   that every interrupt can be traced; dev_id stays NULL so that
+   pal_gic_free_irq keeps matching the action. */
+typedef struct {
+  uint32_t int_id;
+  void (*isr)(void);
+} PAL_GIC_ISR_ENTRY;
+
+static RADIX_TREE(g_gic_isr_tree, GFP_ATOMIC);
+static DEFINE_SPINLOCK(g_gic_isr_lock);
+
+static irqreturn_t pal_gic_isr(int virq, void *dev_id)
+{
+  PAL_GIC_ISR_ENTRY *entry;
+
+  entry = radix_tree_lookup(&g_gic_isr_tree, virq);
+  if (!entry)
+      return IRQ_NONE;
+
+  trace_acs_irq_fire(entry->int_id, virq);
+  entry->isr();
+
+  return IRQ_HANDLED;
+}
+
+static int pal_gic_isr_add(uint32_t int_id, unsigned int virq, void (*isr)(void))
+{
+  PAL_GIC_ISR_ENTRY *entry;
+  unsigned long flags;
+  int ret;
+
+  entry = kmalloc(sizeof(PAL_GIC_ISR_ENTRY), GFP_KERNEL);
+  if (!entry)
+      return -ENOMEM;
+
+  entry->int_id = int_id;
+  entry->isr    = isr;
+
+  spin_lock_irqsave(&g_gic_isr_lock, flags);
+  ret = radix_tree_insert(&g_gic_isr_tree, virq, entry);
+  spin_unlock_irqrestore(&g_gic_isr_lock, flags);
+
+  /* -EEXIST while the virq is still requested, as request_irq would fail */
+  if (ret)
+      kfree(entry);
+
+  return ret;
+}
+
+/* Called once the irq has been freed, so the handler cannot be running */
+static void pal_gic_isr_del(unsigned int virq)
+{
+  PAL_GIC_ISR_ENTRY *entry;
+  unsigned long flags;
+
+  spin_lock_irqsave(&g_gic_isr_lock, flags);
+  entry = radix_tree_delete(&g_gic_isr_tree, virq);
+  spin_unlock_irqrestore(&g_gic_isr_lock, flags);
+
+  kfree(entry);
+}
 
 unsigned int pal_gic_install_isr(unsigned int int_id, void (*isr)(void))
 {
@@ -68,7 +133,13 @@ unsigned int pal_gic_install_isr(unsigned int int_id, void (*isr)(void))
         }
     }
 
-    ret = request_irq(virq, (irq_handler_t)isr, flags, "ACS", NULL);
+    ret = pal_gic_isr_add(int_id, virq, isr);
+    if (ret == 0) {
+        ret = request_irq(virq, pal_gic_isr, flags, "ACS", NULL);
+        if (ret != 0)
+            pal_gic_isr_del(virq);
+    }
+    trace_acs_irq_install(int_id, virq, ret);
     if (ret != 0) {
         acs_print(ACS_PRINT_ERR, "\n       IRQ registration failure %x", int_id);
         acs_print(ACS_PRINT_ERR, " \n      err %d", ret);
@@ -88,10 +159,21 @@ void pal_gic_end_of_interrupt(unsigned int int_id)
 
 uint32_t pal_gic_request_irq(unsigned int irq_num, unsigned int mapped_irq_num, void *isr)
 {
-    return request_irq(mapped_irq_num, (irq_handler_t)isr, 0, NULL, NULL);
+    int ret;
+
+    ret = pal_gic_isr_add(irq_num, mapped_irq_num, (void (*)(void))isr);
+    if (ret == 0) {
+        ret = request_irq(mapped_irq_num, pal_gic_isr, 0, NULL, NULL);
+        if (ret != 0)
+            pal_gic_isr_del(mapped_irq_num);
+    }
+    trace_acs_irq_install(irq_num, mapped_irq_num, ret);
+
+    return ret;
 }
 
 void pal_gic_free_irq(unsigned int irq_num, unsigned int mapped_irq_num)
 {
     free_irq(mapped_irq_num, NULL);
+    pal_gic_isr_del(mapped_irq_num);
 }
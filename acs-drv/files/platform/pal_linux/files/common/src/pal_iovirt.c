@@ -367,6 +367,44 @@ iovirt_add_block(struct acpi_table_iort *iort, struct acpi_iort_node *iort_node,
     return offset;
 }
 
+/**
+  @brief  Bounds the size of the iovirt table built from the IORT. Every node
+          becomes at most one block with one data map per ID mapping (per 4
+          identifiers for ITS groups), and iovirt_add_block stages a block
+          past the last one before finding it is a duplicate, so one more of
+          the largest block is kept as scratch.
+  @return size of the table in bytes, 0 if there is no IORT
+**/
+uint32_t
+pal_iovirt_info_table_size(void)
+{
+    struct acpi_table_iort  *iort;
+    struct acpi_iort_node   *iort_node, *iort_end;
+    uint32_t i, num_map, block_sz, max_block_sz = 0, size;
+
+    iort = (struct acpi_table_iort *)pal_get_iort_ptr();
+    if (!iort)
+        return 0;
+
+    size = offsetof(IOVIRT_INFO_TABLE, blocks);
+    iort_node = ACPI_ADD_PTR(struct acpi_iort_node, iort, iort->node_offset);
+    iort_end = ACPI_ADD_PTR(struct acpi_iort_node, iort, iort->header.length);
+
+    for (i = 0; i < iort->node_count && iort_node < iort_end; i++) {
+        if (iort_node->type == ACPI_IORT_NODE_ITS_GROUP)
+            num_map = (((struct acpi_iort_its_group *)iort_node->node_data)->its_count + 3) / 4;
+        else
+            num_map = iort_node->mapping_count;
+
+        block_sz = sizeof(IOVIRT_BLOCK) + num_map * sizeof(NODE_DATA_MAP);
+        max_block_sz = max(max_block_sz, block_sz);
+        size += block_sz;
+        iort_node = ACPI_ADD_PTR(struct acpi_iort_node, iort_node, iort_node->length);
+    }
+
+    return ALIGN(size + max_block_sz, 16);
+}
+
 /**
   @brief  Parses ACPI IORT table and populates the local iovirt table
 **/
@@ -378,7 +416,7 @@ pal_iovirt_create_info_table(IOVIRT_INFO_TABLE *iovirt_table)
     IOVIRT_BLOCK  *next_block;
     uint32_t i;
 
-    if (iovirt_table == NULL)
+    if (iovirt_table == NULL || pal_info_table_imported(iovirt_table))
         return;
 
     /* Initialize counters */
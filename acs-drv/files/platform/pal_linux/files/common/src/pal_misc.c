@@ -25,12 +25,178 @@
 #include <asm/io.h>
 #include <linux/dma-mapping.h>
 #include <linux/delay.h>
+#include <linux/pci.h>
+#include <linux/percpu.h>
+#include <linux/radix-tree.h>
+#include <linux/rcupdate.h>
+#include <linux/spinlock.h>
+#include <linux/ctype.h>
+#include <linux/string.h>
 #include "common/include/pal_linux.h"
 
+#define CREATE_TRACE_POINTS
+#include "common/include/pal_trace.h"
+
 unsigned int *gSharedMemory;
 
-extern int tail_msg;
-int num_msg = MIN_NUM_MSG;
+/* When set, pal_print defers formatting to the message reader and does not
+   echo to the kernel log, which makes a print in a hot loop a few stores. */
+static bool g_deferred_print;
+module_param_named(deferred_print, g_deferred_print, bool, 0644);
+MODULE_PARM_DESC(deferred_print, "Format messages when they are read instead of when printed");
+
+/* Per-CPU scratch buffers pal_print formats its messages into */
+static DEFINE_PER_CPU(char [PAL_PRINT_BUF_SIZE], g_print_buf);
+
+/* MMIO mappings are cached per physical page for the life of an info table
+   session, so that register heavy tests do not pay for an ioremap/iounmap
+   (and the resulting TLB invalidation) on every single access. */
+typedef struct {
+  struct list_head node;
+  unsigned long    pfn;
+  uint32_t         attr;
+  void __iomem     *va;
+} PAL_MMIO_MAP_ENTRY;
+
+static RADIX_TREE(g_mmio_map_tree, GFP_ATOMIC);
+static LIST_HEAD(g_mmio_map_list);
+static DEFINE_SPINLOCK(g_mmio_map_lock);
+
+static void __iomem *
+pal_mmio_map_page(phys_addr_t pa, uint32_t attr)
+{
+  switch (attr) {
+  case DEVICE_nGnRnE:
+      return pci_remap_cfgspace(pa, PAGE_SIZE);
+  case NORMAL_NC:
+      return ioremap_wc(pa, PAGE_SIZE);
+  default:
+      return ioremap(pa, PAGE_SIZE);
+  }
+}
+
+/**
+  @brief  Returns a cached virtual address for a physical MMIO address,
+          creating a page sized mapping with the given attribute on a miss.
+
+  @param  addr   64-bit physical address
+  @param  width  access width in bytes
+  @param  attr   memory attribute of the mapping
+
+  @return Virtual address, or NULL if the access cannot be served from the
+          cache (page crossing access, attribute mismatch or no memory)
+**/
+static void __iomem *
+pal_mmio_map_cache_get(uint64_t addr, uint32_t width, uint32_t attr)
+{
+  unsigned long pfn = addr >> PAGE_SHIFT;
+  PAL_MMIO_MAP_ENTRY *entry, *new_entry;
+  void __iomem *va = NULL;
+  unsigned long flags;
+  bool found;
+
+  if (offset_in_page(addr) + width > PAGE_SIZE)
+      return NULL;
+
+  /* The entry may be freed once the read side section ends, so only the
+     mapping is taken out of it */
+  rcu_read_lock();
+  entry = radix_tree_lookup(&g_mmio_map_tree, pfn);
+  found = (entry != NULL);
+  if (found && entry->attr == attr)
+      va = entry->va + offset_in_page(addr);
+  rcu_read_unlock();
+
+  if (found)
+      return va;
+
+  /* Misses taken from interrupt context fall back to a transient mapping */
+  if (in_interrupt() || irqs_disabled())
+      return NULL;
+
+  new_entry = kmalloc(sizeof(PAL_MMIO_MAP_ENTRY), GFP_KERNEL);
+  if (!new_entry)
+      return NULL;
+
+  new_entry->pfn  = pfn;
+  new_entry->attr = attr;
+  new_entry->va   = pal_mmio_map_page((phys_addr_t)pfn << PAGE_SHIFT, attr);
+  if (!new_entry->va) {
+      kfree(new_entry);
+      return NULL;
+  }
+
+  if (radix_tree_preload(GFP_KERNEL)) {
+      iounmap(new_entry->va);
+      kfree(new_entry);
+      return NULL;
+  }
+
+  spin_lock_irqsave(&g_mmio_map_lock, flags);
+  entry = radix_tree_lookup(&g_mmio_map_tree, pfn);
+  if (!entry) {
+      radix_tree_insert(&g_mmio_map_tree, pfn, new_entry);
+      list_add(&new_entry->node, &g_mmio_map_list);
+      entry = new_entry;
+      new_entry = NULL;
+  }
+  if (entry->attr == attr)
+      va = entry->va + offset_in_page(addr);
+  spin_unlock_irqrestore(&g_mmio_map_lock, flags);
+  radix_tree_preload_end();
+
+  /* Lost the race against another PE mapping the same page */
+  if (new_entry) {
+      iounmap(new_entry->va);
+      kfree(new_entry);
+  }
+
+  return va;
+}
+
+/**
+  @brief  Releases all the cached MMIO mappings. Called when the info
+          tables are freed, after which no test can be using them.
+**/
+void pal_mmio_map_cache_free(void)
+{
+  PAL_MMIO_MAP_ENTRY *entry, *tmp;
+  unsigned long flags;
+  LIST_HEAD(free_list);
+
+  spin_lock_irqsave(&g_mmio_map_lock, flags);
+  list_for_each_entry(entry, &g_mmio_map_list, node)
+      radix_tree_delete(&g_mmio_map_tree, entry->pfn);
+  list_splice_init(&g_mmio_map_list, &free_list);
+  spin_unlock_irqrestore(&g_mmio_map_lock, flags);
+
+  synchronize_rcu();
+
+  list_for_each_entry_safe(entry, tmp, &free_list, node) {
+      iounmap(entry->va);
+      kfree(entry);
+  }
+}
+
+static inline void __iomem *
+pal_mmio_map(uint64_t addr, uint32_t width, bool *transient)
+{
+  void __iomem *p;
+
+  p = pal_mmio_map_cache_get(addr, width, DEVICE_nGnRE);
+  *transient = (p == NULL);
+  if (*transient)
+      p = ioremap(addr, 16);
+
+  return p;
+}
+
+static inline void
+pal_mmio_unmap(void __iomem *p, bool transient)
+{
+  if (transient)
+      iounmap(p);
+}
 
 /**
   @brief  Provides a single point of abstraction to read 8 bit data from
@@ -44,13 +210,12 @@ uint8_t pal_mmio_read8(uint64_t addr)
 {
   uint8_t data;
   void __iomem *p;
+  bool transient;
 
-  p = ioremap(addr, 16);
+  p = pal_mmio_map(addr, sizeof(data), &transient);
   data = ioread8(p);
-
-  //Print(L"Address = %8x  ", addr);
-  //Print(L" data = %8x \n", data);
-  iounmap(p);
+  pal_mmio_unmap(p, transient);
+  trace_acs_mmio_read(addr, sizeof(data), data);
 
   return data;
 }
@@ -67,13 +232,12 @@ uint16_t pal_mmio_read16(uint64_t addr)
 {
   uint16_t data;
   void __iomem *p;
+  bool transient;
 
-  p = ioremap(addr, 16);
+  p = pal_mmio_map(addr, sizeof(data), &transient);
   data = ioread16(p);
-
-  //Print(L"Address = %8x  ", addr);
-  //Print(L" data = %8x \n", data);
-  iounmap(p);
+  pal_mmio_unmap(p, transient);
+  trace_acs_mmio_read(addr, sizeof(data), data);
 
   return data;
 }
@@ -90,13 +254,12 @@ uint64_t pal_mmio_read64(uint64_t addr)
 {
   uint64_t data;
   void __iomem *p;
+  bool transient;
 
-  p = ioremap(addr, 16);
+  p = pal_mmio_map(addr, sizeof(data), &transient);
   data = ioread64(p);
-
-  //Print(L"Address = %16x  ", addr);
-  //Print(L" data = %16x \n", data);
-  iounmap(p);
+  pal_mmio_unmap(p, transient);
+  trace_acs_mmio_read(addr, sizeof(data), data);
 
   return data;
 }
@@ -113,18 +276,18 @@ uint32_t pal_mmio_read(uint64_t addr)
 {
   uint32_t data;
   void __iomem *p;
+  bool transient;
 
   if (addr & 0x3) {
       acs_print(ACS_PRINT_INFO, "\n  Error-Input address is not aligned."
                                 " Masking the last 2 bits \n", 0);
       addr = addr & ~(0x3);  //make sure addr is aligned to 4 bytes
   }
-  p = ioremap(addr, 16);
-  //Print(L"Address = %8x  ", addr);
-  data = ioread32(p);
 
-  //Print(L" data = %8x \n", data);
-  iounmap(p);
+  p = pal_mmio_map(addr, sizeof(data), &transient);
+  data = ioread32(p);
+  pal_mmio_unmap(p, transient);
+  trace_acs_mmio_read(addr, sizeof(data), data);
 
   return data;
 }
@@ -141,11 +304,12 @@ uint32_t pal_mmio_read(uint64_t addr)
 void pal_mmio_write8(uint64_t addr, uint8_t data)
 {
   void __iomem *p;
-  p = ioremap(addr, 16);
-  //Print(L"Address = %8x  Data = %8x \n", addr, data);
-  iowrite8(data, p);
+  bool transient;
 
-  iounmap(p);
+  p = pal_mmio_map(addr, sizeof(data), &transient);
+  iowrite8(data, p);
+  pal_mmio_unmap(p, transient);
+  trace_acs_mmio_write(addr, sizeof(data), data);
 }
 
 /**
@@ -160,11 +324,12 @@ void pal_mmio_write8(uint64_t addr, uint8_t data)
 void pal_mmio_write16(uint64_t addr, uint16_t data)
 {
   void __iomem *p;
-  p = ioremap(addr, 16);
-  //Print(L"Address = %8x  Data = %8x \n", addr, data);
-  iowrite16(data, p);
+  bool transient;
 
-  iounmap(p);
+  p = pal_mmio_map(addr, sizeof(data), &transient);
+  iowrite16(data, p);
+  pal_mmio_unmap(p, transient);
+  trace_acs_mmio_write(addr, sizeof(data), data);
 }
 
 /**
@@ -179,11 +344,12 @@ void pal_mmio_write16(uint64_t addr, uint16_t data)
 void pal_mmio_write64(uint64_t addr, uint64_t data)
 {
   void __iomem *p;
-  p = ioremap(addr, 16);
-  //Print(L"Address = %16x  Data = %16x \n", addr, data);
-  iowrite64(data, p);
+  bool transient;
 
-  iounmap(p);
+  p = pal_mmio_map(addr, sizeof(data), &transient);
+  iowrite64(data, p);
+  pal_mmio_unmap(p, transient);
+  trace_acs_mmio_write(addr, sizeof(data), data);
 }
 
 /**
@@ -198,11 +364,81 @@ void pal_mmio_write64(uint64_t addr, uint64_t data)
 void pal_mmio_write(uint64_t addr, uint32_t data)
 {
   void __iomem *p;
-  p = ioremap(addr, 16);
-  //Print(L"Address = %8x  Data = %8x \n", addr, data);
+  bool transient;
+
+  p = pal_mmio_map(addr, sizeof(data), &transient);
   iowrite32(data, p);
+  pal_mmio_unmap(p, transient);
+  trace_acs_mmio_write(addr, sizeof(data), data);
+}
+
+/* Table handed over by pal_info_table_import, consumed by the next create
+   call made on it. Set and consumed under the drv's command lock. */
+static void *g_import_table;
 
-  iounmap(p);
+/**
+  @brief  Marks a table as filled from a snapshot, or clears the mark
+
+  @param  table  info table the next create call is made on, or NULL
+**/
+void pal_info_table_import(void *table)
+{
+  g_import_table = table;
+}
+
+/**
+  @brief  Called by the create functions before discovering a table
+
+  @param  table  info table being created
+
+  @return true if the table was imported and must be kept as it is
+**/
+bool pal_info_table_imported(void *table)
+{
+  if (!table || table != g_import_table)
+      return false;
+
+  g_import_table = NULL;
+  return true;
+}
+
+/**
+  @brief  Checks that a format string can be rendered later from its
+          argument value alone: every conversion must be a plain integer
+          conversion (d, i, u, x, X or c) with optional flags, digit width,
+          digit precision and length modifier.
+
+  @param  fmt  An ASCII format string
+
+  @return true if the format may be deferred, false otherwise
+**/
+static bool pal_print_fmt_deferrable(const char *fmt)
+{
+  while ((fmt = strchr(fmt, '%')) != NULL) {
+      fmt++;
+      if (*fmt == '%') {
+          fmt++;
+          continue;
+      }
+
+      while (*fmt && strchr("-+ #0", *fmt))
+          fmt++;
+      while (isdigit(*fmt))
+          fmt++;
+      if (*fmt == '.') {
+          fmt++;
+          while (isdigit(*fmt))
+              fmt++;
+      }
+      while (*fmt && strchr("hlzjt", *fmt))
+          fmt++;
+
+      if (!*fmt || !strchr("diuxXc", *fmt))
+          return false;
+      fmt++;
+  }
+
+  return true;
 }
 
 /**
@@ -215,17 +451,49 @@ void pal_mmio_write(uint64_t addr, uint32_t data)
 **/
 void pal_print(char *string, uint64_t data)
 {
-  char  *modifiedfmt = NULL;
-  char *fmt = KERN_CONT;
-
-  modifiedfmt = kzalloc((strlen(string) + strlen(fmt) + 1 )*sizeof(char), GFP_KERNEL);
-  if (modifiedfmt) {
-      strcpy(modifiedfmt, fmt);
-      strcat(modifiedfmt, string);
-      printk(modifiedfmt, data);
+  unsigned long flags;
+  char *buf;
+
+  /* Formats that live in this module's core image, and so stay valid until
+     the module is unloaded, and whose conversions only print the integer
+     argument are recorded; formatting happens when they are read. */
+  if (g_deferred_print && within_module_core((unsigned long)string, THIS_MODULE) &&
+      pal_print_fmt_deferrable(string)) {
+      pal_msg_put_deferred(string, data);
+      return;
   }
 
-  kfree(modifiedfmt);
+  /* Format into this CPU's scratch buffer. Interrupts are kept off while
+     the buffer is in use so that an ISR printing on the same CPU cannot
+     overwrite it, which also makes pal_print safe from atomic context. */
+  local_irq_save(flags);
+  buf = this_cpu_ptr(g_print_buf);
+  snprintf(buf, PAL_PRINT_BUF_SIZE, string, data);
+  printk(KERN_CONT "%s", buf);
+  pal_msg_put(buf, data);
+  local_irq_restore(flags);
+}
+
+DEFINE_STATIC_KEY_ARRAY_FALSE(g_print_enabled, ACS_PRINT_ERR + 1);
+
+/**
+  @brief  Updates the static keys gating acs_print to a new print level.
+          Must be called from process context.
+
+  @param  level  lowest verbosity that is printed
+
+  @return None
+**/
+void pal_print_set_level(uint32_t level)
+{
+  uint32_t i;
+
+  for (i = ACS_PRINT_INFO; i <= ACS_PRINT_ERR; i++) {
+      if (i >= level)
+          static_branch_enable(&g_print_enabled[i]);
+      else
+          static_branch_disable(&g_print_enabled[i]);
+  }
 }
 
 /**
@@ -266,6 +534,7 @@ void *pal_mem_alloc_cacheable(uint32_t bdf, uint32_t size, void **pa)
 
   dev = pal_pci_bdf_to_dev(bdf);
   buf_virt = dma_alloc_coherent(dev, size, &buf_phys, GFP_KERNEL);
+  put_device(dev);
 
   *pa = (void *)buf_phys;
   return buf_virt;
@@ -324,6 +593,7 @@ void pal_mem_free_cacheable(uint32_t bdf, uint32_t size, void *va, void *pa)
 
   dev = pal_pci_bdf_to_dev(bdf);
   dma_free_coherent(dev, size, va, (dma_addr_t)pa);
+  put_device(dev);
 }
 
 /**
@@ -371,6 +641,7 @@ uint64_t pal_mem_get_shared_addr(void)
 void pal_mem_free_shared(void)
 {
   kfree ((void *)gSharedMemory);
+  gSharedMemory = NULL;
 }
 
 /**
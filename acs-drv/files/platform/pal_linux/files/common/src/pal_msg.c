@@ -0,0 +1,552 @@
+/*
+ * BSA SBSA ACS Platform module.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2024 Arm Limited
+ *
+ */
+
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/cpumask.h>
+#include <linux/mutex.h>
+#include <linux/wait.h>
+#include <linux/uaccess.h>
+#include <linux/vmalloc.h>
+#include <linux/miscdevice.h>
+#include <linux/workqueue.h>
+#include <linux/kfifo.h>
+#include <linux/version.h>
+#include "common/include/pal_msg.h"
+
+/* Each CPU owns a single producer ring. Records are stamped with a global
+   sequence number so the reader can merge the rings back in print order. */
+typedef struct {
+  uint64_t        seq;
+  const char      *fmt;   /* set for deferred records, formatted on read */
+  pal_msg_parms_t msg;
+} PAL_MSG_RECORD;
+
+typedef struct {
+  uint32_t       head;    /* only written by the owning CPU */
+  uint32_t       tail;    /* only written by the reader */
+  PAL_MSG_RECORD rec[PAL_MSG_RING_SIZE];
+} PAL_MSG_RING;
+
+static PAL_MSG_RING **g_msg_ring;
+static atomic64_t g_msg_seq;
+static atomic64_t g_msg_dropped;
+static bool g_msg_active;
+static DEFINE_MUTEX(g_msg_read_lock);
+static DECLARE_WAIT_QUEUE_HEAD(g_msg_wait);
+
+/* Binary result records, produced by the command glue in process context */
+static DEFINE_KFIFO(g_msg_result, pal_result_t, PAL_RESULT_FIFO_SIZE);
+static DEFINE_SPINLOCK(g_msg_result_lock);
+static DEFINE_MUTEX(g_msg_result_read_lock);
+static atomic64_t g_msg_result_dropped;
+
+/* Shared results ring, filled from the per-CPU rings by a worker while the
+   msg device is open. The producer state lives in kernel memory and is only
+   published to the header page, which userspace cannot write. While the
+   shared ring is open it is the only consumer of the per-CPU rings. */
+#define PAL_MSG_SHM_TAIL_OFFSET     PAGE_SIZE
+#define PAL_MSG_SHM_RECORDS_OFFSET  (2 * PAGE_SIZE)
+#define PAL_MSG_SHM_SIZE  (PAL_MSG_SHM_RECORDS_OFFSET + \
+                           PAGE_ALIGN(PAL_MSG_SHM_RECORDS * sizeof(pal_msg_parms_t)))
+
+static pal_msg_shm_hdr_t *g_msg_shm;
+static pal_msg_parms_t *g_msg_shm_rec;
+static uint64_t *g_msg_shm_tail;
+static uint64_t g_msg_shm_head;
+static bool g_msg_shm_open;
+static DEFINE_MUTEX(g_msg_shm_lock);
+static DECLARE_WAIT_QUEUE_HEAD(g_msg_shm_wait);
+static void pal_msg_shm_drain(struct work_struct *work);
+static DECLARE_WORK(g_msg_shm_work, pal_msg_shm_drain);
+static struct miscdevice g_msg_miscdev;
+static bool pal_msg_pending(void);
+static bool pal_msg_take(pal_msg_parms_t *msg);
+
+/* Moves records from the per-CPU rings into the shared ring until either
+   side runs out. When the application is behind, the records stay in the
+   per-CPU rings until it polls the device again after consuming. */
+static void pal_msg_shm_drain(struct work_struct *work)
+{
+  pal_msg_shm_hdr_t *hdr = g_msg_shm;
+  uint64_t head;
+
+  /* The tail is written by the application and only gates flow control;
+     the slot written is always derived from the kernel's own head. */
+  mutex_lock(&g_msg_read_lock);
+  head = g_msg_shm_head;
+  for (;;) {
+      if (head - smp_load_acquire(g_msg_shm_tail) >= PAL_MSG_SHM_RECORDS)
+          break;
+
+      if (!pal_msg_take(&g_msg_shm_rec[head & (PAL_MSG_SHM_RECORDS - 1)]))
+          break;
+
+      g_msg_shm_head = ++head;
+      smp_store_release(&hdr->head, head);
+  }
+  WRITE_ONCE(hdr->dropped, atomic64_read(&g_msg_dropped));
+  mutex_unlock(&g_msg_read_lock);
+
+  wake_up_interruptible(&g_msg_shm_wait);
+}
+
+static inline void pal_msg_shm_kick(void)
+{
+  if (READ_ONCE(g_msg_shm_open))
+      queue_work(system_wq, &g_msg_shm_work);
+}
+
+static int pal_msg_shm_open(struct inode *inode, struct file *file)
+{
+  pal_msg_shm_hdr_t *hdr = g_msg_shm;
+
+  /* A single consumer owns the shared ring at a time */
+  mutex_lock(&g_msg_shm_lock);
+  if (g_msg_shm_open) {
+      mutex_unlock(&g_msg_shm_lock);
+      return -EBUSY;
+  }
+
+  mutex_lock(&g_msg_read_lock);
+  g_msg_shm_head = 0;
+  hdr->head = 0;
+  *g_msg_shm_tail = 0;
+  hdr->dropped = 0;
+  WRITE_ONCE(g_msg_shm_open, true);
+  mutex_unlock(&g_msg_read_lock);
+  mutex_unlock(&g_msg_shm_lock);
+
+  /* Readers blocked on the msg interface give way to the shared ring */
+  wake_up_interruptible_all(&g_msg_wait);
+
+  /* Pick up whatever was buffered before the device was opened */
+  pal_msg_shm_kick();
+
+  return 0;
+}
+
+static int pal_msg_shm_release(struct inode *inode, struct file *file)
+{
+  mutex_lock(&g_msg_shm_lock);
+  WRITE_ONCE(g_msg_shm_open, false);
+  cancel_work_sync(&g_msg_shm_work);
+  mutex_unlock(&g_msg_shm_lock);
+
+  return 0;
+}
+
+/* Only the page holding the tail may be mapped writable, and only on its
+   own; the header and the records are mapped read-only. */
+static int pal_msg_shm_mmap(struct file *file, struct vm_area_struct *vma)
+{
+  unsigned long size = vma->vm_end - vma->vm_start;
+  unsigned long offset = vma->vm_pgoff << PAGE_SHIFT;
+  bool tail_page;
+
+  if (offset >= PAL_MSG_SHM_SIZE || size > PAL_MSG_SHM_SIZE - offset)
+      return -EINVAL;
+
+  tail_page = (offset == PAL_MSG_SHM_TAIL_OFFSET && size == PAGE_SIZE);
+  if (!tail_page) {
+      if (vma->vm_flags & VM_WRITE)
+          return -EPERM;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,3,0)
+      vm_flags_clear(vma, VM_MAYWRITE);
+#else
+      vma->vm_flags &= ~VM_MAYWRITE;
+#endif
+  }
+
+  return remap_vmalloc_range(vma, g_msg_shm, vma->vm_pgoff);
+}
+
+/* Polling is how the application hands back the space it consumed: if the
+   shared ring has room and records are still buffered, the drain is kicked
+   and the poller is woken once it has published them. */
+static __poll_t pal_msg_shm_poll(struct file *file, poll_table *wait)
+{
+  uint64_t head, tail;
+
+  poll_wait(file, &g_msg_shm_wait, wait);
+
+  head = READ_ONCE(g_msg_shm_head);
+  tail = smp_load_acquire(g_msg_shm_tail);
+  if (head - tail < PAL_MSG_SHM_RECORDS && pal_msg_pending())
+      pal_msg_shm_kick();
+
+  if (head != tail)
+      return EPOLLIN | EPOLLRDNORM;
+
+  return 0;
+}
+
+static const struct file_operations g_msg_shm_fops = {
+  .owner   = THIS_MODULE,
+  .open    = pal_msg_shm_open,
+  .release = pal_msg_shm_release,
+  .mmap    = pal_msg_shm_mmap,
+  .poll    = pal_msg_shm_poll,
+};
+
+/**
+  @brief  Allocates the per-CPU message rings and registers the mmap-able
+          /dev/<name> device exporting the shared results ring
+
+  @param  name  name of the msg device
+
+  @return 0 on success, negative error code otherwise
+**/
+int pal_msg_init(const char *name)
+{
+  unsigned int cpu;
+  int ret;
+
+  g_msg_ring = kcalloc(nr_cpu_ids, sizeof(PAL_MSG_RING *), GFP_KERNEL);
+  if (!g_msg_ring)
+      return -ENOMEM;
+
+  for_each_possible_cpu(cpu) {
+      g_msg_ring[cpu] = kvzalloc_node(sizeof(PAL_MSG_RING), GFP_KERNEL, cpu_to_node(cpu));
+      if (!g_msg_ring[cpu]) {
+          pal_msg_exit();
+          return -ENOMEM;
+      }
+  }
+
+  g_msg_shm = vmalloc_user(PAL_MSG_SHM_SIZE);
+  if (!g_msg_shm) {
+      pal_msg_exit();
+      return -ENOMEM;
+  }
+
+  g_msg_shm->magic          = PAL_MSG_SHM_MAGIC;
+  g_msg_shm->version        = PAL_MSG_SHM_VERSION;
+  g_msg_shm->record_size    = sizeof(pal_msg_parms_t);
+  g_msg_shm->num_records    = PAL_MSG_SHM_RECORDS;
+  g_msg_shm->records_offset = PAL_MSG_SHM_RECORDS_OFFSET;
+  g_msg_shm->tail_offset    = PAL_MSG_SHM_TAIL_OFFSET;
+  g_msg_shm_tail = (uint64_t *)((char *)g_msg_shm + PAL_MSG_SHM_TAIL_OFFSET);
+  g_msg_shm_rec  = (pal_msg_parms_t *)((char *)g_msg_shm + PAL_MSG_SHM_RECORDS_OFFSET);
+
+  g_msg_miscdev.minor = MISC_DYNAMIC_MINOR;
+  g_msg_miscdev.name  = name;
+  g_msg_miscdev.fops  = &g_msg_shm_fops;
+  g_msg_miscdev.mode  = 0600;
+  ret = misc_register(&g_msg_miscdev);
+  if (ret) {
+      g_msg_miscdev.name = NULL;
+      pal_msg_exit();
+      return ret;
+  }
+
+  return 0;
+}
+
+/**
+  @brief  Unregisters the msg device and frees the message rings
+**/
+void pal_msg_exit(void)
+{
+  unsigned int cpu;
+
+  if (g_msg_miscdev.name) {
+      misc_deregister(&g_msg_miscdev);
+      g_msg_miscdev.name = NULL;
+  }
+
+  vfree(g_msg_shm);
+  g_msg_shm = NULL;
+
+  if (!g_msg_ring)
+      return;
+
+  for_each_possible_cpu(cpu)
+      kvfree(g_msg_ring[cpu]);
+
+  kfree(g_msg_ring);
+  g_msg_ring = NULL;
+}
+
+/**
+  @brief  Discards all the buffered records and the drop count. Only the
+          reader side indices are touched, so producers may keep running.
+**/
+void pal_msg_reset(void)
+{
+  PAL_MSG_RING *ring;
+  unsigned int cpu;
+
+  mutex_lock(&g_msg_read_lock);
+  for_each_possible_cpu(cpu) {
+      ring = g_msg_ring[cpu];
+      smp_store_release(&ring->tail, smp_load_acquire(&ring->head));
+  }
+  atomic64_set(&g_msg_dropped, 0);
+  mutex_unlock(&g_msg_read_lock);
+
+  mutex_lock(&g_msg_result_read_lock);
+  spin_lock(&g_msg_result_lock);
+  kfifo_reset(&g_msg_result);
+  spin_unlock(&g_msg_result_lock);
+  atomic64_set(&g_msg_result_dropped, 0);
+  mutex_unlock(&g_msg_result_read_lock);
+}
+
+/**
+  @brief  Marks whether a test run is in progress. While active, readers
+          block for new records instead of returning end of file.
+
+  @param  active  true while tests execute
+**/
+void pal_msg_set_active(bool active)
+{
+  WRITE_ONCE(g_msg_active, active);
+
+  if (!active) {
+      if (atomic64_read(&g_msg_dropped))
+          pr_warn("ACS: %lld messages dropped\n", atomic64_read(&g_msg_dropped));
+      if (atomic64_read(&g_msg_result_dropped))
+          pr_warn("ACS: %lld result records dropped\n", atomic64_read(&g_msg_result_dropped));
+      wake_up_interruptible_all(&g_msg_wait);
+      pal_msg_shm_kick();
+  }
+}
+
+static void __pal_msg_put(const char *string, const char *fmt, uint64_t data)
+{
+  PAL_MSG_RING *ring;
+  PAL_MSG_RECORD *rec;
+  unsigned long flags;
+  uint32_t head;
+
+  if (!g_msg_ring)
+      return;
+
+  local_irq_save(flags);
+  ring = g_msg_ring[smp_processor_id()];
+  head = ring->head;
+
+  if (head - smp_load_acquire(&ring->tail) >= PAL_MSG_RING_SIZE) {
+      atomic64_inc(&g_msg_dropped);
+      local_irq_restore(flags);
+      return;
+  }
+
+  rec = &ring->rec[head & (PAL_MSG_RING_SIZE - 1)];
+  rec->seq = atomic64_inc_return(&g_msg_seq);
+  rec->fmt = fmt;
+  if (string)
+      strscpy(rec->msg.string, string, sizeof(rec->msg.string));
+  rec->msg.data = data;
+  smp_store_release(&ring->head, head + 1);
+  local_irq_restore(flags);
+
+  if (wq_has_sleeper(&g_msg_wait))
+      wake_up_interruptible(&g_msg_wait);
+
+  pal_msg_shm_kick();
+}
+
+/**
+  @brief  Appends a record to the ring of the current CPU. Safe from any
+          context; if the ring is full the record is dropped and counted.
+
+  @param  string  formatted message
+  @param  data    data value passed along with the message
+**/
+void pal_msg_put(const char *string, uint64_t data)
+{
+  __pal_msg_put(string, NULL, data);
+}
+
+/**
+  @brief  Appends a record holding only the format and its argument. The
+          message is formatted when the record is read, so fmt must stay
+          valid until then and must not dereference data (no %s).
+
+  @param  fmt   printf style format with at most one argument
+  @param  data  argument of fmt
+**/
+void pal_msg_put_deferred(const char *fmt, uint64_t data)
+{
+  __pal_msg_put(NULL, fmt, data);
+}
+
+static bool pal_msg_pending(void)
+{
+  PAL_MSG_RING *ring;
+  unsigned int cpu;
+
+  for_each_possible_cpu(cpu) {
+      ring = g_msg_ring[cpu];
+      if (READ_ONCE(ring->tail) != smp_load_acquire(&ring->head))
+          return true;
+  }
+
+  return false;
+}
+
+/* Removes the oldest buffered record across all the rings.
+   Called with g_msg_read_lock held. */
+static bool pal_msg_take(pal_msg_parms_t *msg)
+{
+  PAL_MSG_RING *ring, *oldest = NULL;
+  PAL_MSG_RECORD *rec, *oldest_rec = NULL;
+  unsigned int cpu;
+  uint32_t tail;
+
+  for_each_possible_cpu(cpu) {
+      ring = g_msg_ring[cpu];
+      tail = ring->tail;
+      if (tail == smp_load_acquire(&ring->head))
+          continue;
+
+      rec = &ring->rec[tail & (PAL_MSG_RING_SIZE - 1)];
+      if (!oldest_rec || rec->seq < oldest_rec->seq) {
+          oldest = ring;
+          oldest_rec = rec;
+      }
+  }
+
+  if (!oldest)
+      return false;
+
+  if (oldest_rec->fmt) {
+      snprintf(msg->string, sizeof(msg->string), oldest_rec->fmt, oldest_rec->msg.data);
+      msg->data = oldest_rec->msg.data;
+  } else {
+      *msg = oldest_rec->msg;
+  }
+  smp_store_release(&oldest->tail, oldest->tail + 1);
+
+  return true;
+}
+
+/**
+  @brief  Copies as many whole records as fit in the user buffer. While a
+          run is active an empty ring blocks (or returns -EAGAIN for non
+          blocking files); otherwise an empty ring reads as end of file.
+          Fails with -EBUSY while the shared ring device is open, since
+          that device then owns the records.
+
+  @param  file  file being read
+  @param  buf   user buffer
+  @param  size  size of the user buffer
+
+  @return Number of bytes copied or a negative error code
+**/
+ssize_t pal_msg_read(struct file *file, char __user *buf, size_t size)
+{
+  pal_msg_parms_t msg;
+  size_t count = 0;
+  int ret;
+
+  if (size < sizeof(pal_msg_parms_t))
+      return -EINVAL;
+
+  for (;;) {
+      mutex_lock(&g_msg_read_lock);
+      if (READ_ONCE(g_msg_shm_open)) {
+          mutex_unlock(&g_msg_read_lock);
+          return count ? count : -EBUSY;
+      }
+      while (count + sizeof(msg) <= size && pal_msg_take(&msg)) {
+          if (copy_to_user(buf + count, &msg, sizeof(msg))) {
+              mutex_unlock(&g_msg_read_lock);
+              return count ? count : -EFAULT;
+          }
+          count += sizeof(msg);
+      }
+      mutex_unlock(&g_msg_read_lock);
+
+      if (count || !READ_ONCE(g_msg_active))
+          return count;
+
+      if (file->f_flags & O_NONBLOCK)
+          return -EAGAIN;
+
+      ret = wait_event_interruptible(g_msg_wait,
+                                     pal_msg_pending() || !READ_ONCE(g_msg_active) ||
+                                     READ_ONCE(g_msg_shm_open));
+      if (ret)
+          return ret;
+  }
+}
+
+/**
+  @brief  Reports the msg interface readable when records are buffered and
+          hung up once the run has finished and everything was consumed.
+**/
+__poll_t pal_msg_poll(struct file *file, poll_table *wait)
+{
+  poll_wait(file, &g_msg_wait, wait);
+
+  if (pal_msg_pending())
+      return EPOLLIN | EPOLLRDNORM;
+
+  if (!READ_ONCE(g_msg_active))
+      return EPOLLHUP;
+
+  return 0;
+}
+
+/**
+  @brief  Returns the number of records dropped because a ring was full
+**/
+uint64_t pal_msg_dropped(void)
+{
+  return atomic64_read(&g_msg_dropped);
+}
+
+/**
+  @brief  Queues a binary result record. The record is dropped (and
+          counted) if the reader has fallen PAL_RESULT_FIFO_SIZE behind.
+
+  @param  result  record to queue
+**/
+void pal_msg_result_put(const pal_result_t *result)
+{
+  if (!kfifo_in_spinlocked(&g_msg_result, result, 1, &g_msg_result_lock))
+      atomic64_inc(&g_msg_result_dropped);
+}
+
+/**
+  @brief  Copies as many whole result records as fit in the user buffer
+
+  @param  buf   user buffer
+  @param  size  size of the user buffer
+
+  @return Number of bytes copied, 0 when no record is queued, or a
+          negative error code
+**/
+ssize_t pal_msg_result_read(char __user *buf, size_t size)
+{
+  unsigned int copied;
+  int ret;
+
+  if (size < sizeof(pal_result_t))
+      return -EINVAL;
+
+  mutex_lock(&g_msg_result_read_lock);
+  ret = kfifo_to_user(&g_msg_result, buf, size - size % sizeof(pal_result_t), &copied);
+  mutex_unlock(&g_msg_result_read_lock);
+
+  return ret ? ret : copied;
+}
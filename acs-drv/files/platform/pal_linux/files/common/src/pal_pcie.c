@@ -21,9 +21,13 @@
  */
 
 #include "common/include/pal_linux.h"
+#include "common/include/pal_pcie_enum.h"
+#include "common/include/pal_trace.h"
 #include "bsa/include/bsa_pal_dt.h"
 
+#include <linux/io.h>
 #include <linux/irq.h>
+#include <linux/module.h>
 #include <linux/pci.h>
 #include <linux/msi.h>
 #include <linux/acpi.h>
@@ -129,7 +133,7 @@ pal_get_msi_vectors (uint32_t seg, uint32_t bus, uint32_t dev, uint32_t fn, PERI
   if(mvector == NULL)
     return 0;
 
-  pdev = pci_get_domain_bus_and_slot (seg, bus, PCI_DEVFN (dev, fn));
+  pdev = pal_pci_dev_get(seg, bus, dev, fn);
 
   if(pdev != NULL) {
 #if LINUX_VERSION_CODE > KERNEL_VERSION(5,16,0)
@@ -159,6 +163,7 @@ pal_get_msi_vectors (uint32_t seg, uint32_t bus, uint32_t dev, uint32_t fn, PERI
 #if LINUX_VERSION_CODE > KERNEL_VERSION(5,16,0)
     msi_unlock_descs(&pdev->dev);
 #endif
+    pci_dev_put(pdev);
   }
 
   return vcount;
@@ -184,6 +189,194 @@ pal_pcie_get_mcfg_ecam(void)
 }
 
 
+/* Direct ECAM access. Each MCFG window is mapped once, when the PCIe info
+   table is built, and config reads become plain loads from it instead of
+   going through the locked kernel accessors. Off by default: platforms
+   whose ECAM needs a kernel quirk must keep using the kernel accessors. */
+typedef struct {
+    uint32_t segment;
+    uint32_t start_bus;
+    uint32_t end_bus;
+    void __iomem *base;     /* config space of start_bus */
+} PAL_ECAM_WINDOW;
+
+static bool g_direct_ecam;
+module_param_named(direct_ecam, g_direct_ecam, bool, 0444);
+MODULE_PARM_DESC(direct_ecam, "Read config space straight from the MCFG ECAM windows");
+
+static PAL_ECAM_WINDOW *g_ecam_windows;
+static uint32_t g_ecam_num_windows;
+
+/**
+  @brief  Maps every MCFG ECAM window, once, when direct ECAM is enabled
+ **/
+void
+pal_pcie_ecam_map(void)
+{
+    struct acpi_table_mcfg      *mcfg;
+    struct acpi_mcfg_allocation *entry;
+    PAL_ECAM_WINDOW *windows;
+    uint32_t i, num;
+
+    if (!g_direct_ecam || g_ecam_windows)
+        return;
+
+    mcfg = (struct acpi_table_mcfg *)pal_get_mcfg_ptr();
+    if (!mcfg || mcfg->header.length <= sizeof(struct acpi_table_mcfg))
+        return;
+
+    num = (mcfg->header.length - sizeof(struct acpi_table_mcfg)) /
+          sizeof(struct acpi_mcfg_allocation);
+    windows = kcalloc(num, sizeof(PAL_ECAM_WINDOW), GFP_KERNEL);
+    if (!windows)
+        return;
+
+    entry = (struct acpi_mcfg_allocation *) &mcfg[1];
+    for (i = 0; i < num; i++, entry++) {
+        windows[i].segment   = entry->pci_segment;
+        windows[i].start_bus = entry->start_bus_number;
+        windows[i].end_bus   = entry->end_bus_number;
+        if (windows[i].end_bus < windows[i].start_bus)
+            continue;
+        /* The MCFG base address is that of bus 0 of the segment */
+        windows[i].base = pci_remap_cfgspace(entry->address + ((uint64_t)entry->start_bus_number << 20),
+                                             (windows[i].end_bus - windows[i].start_bus + 1) << 20);
+        if (!windows[i].base)
+            acs_print(ACS_PRINT_WARN, "Could not map ECAM of segment %x\n", entry->pci_segment);
+    }
+
+    g_ecam_windows = windows;
+    smp_store_release(&g_ecam_num_windows, num);
+}
+
+/**
+  @brief  Unmaps the ECAM windows, called once no config access can be made
+ **/
+void
+pal_pcie_ecam_unmap(void)
+{
+    uint32_t i;
+
+    for (i = 0; i < g_ecam_num_windows; i++)
+        if (g_ecam_windows[i].base)
+            iounmap(g_ecam_windows[i].base);
+
+    g_ecam_num_windows = 0;
+    kfree(g_ecam_windows);
+    g_ecam_windows = NULL;
+}
+
+static void __iomem *
+pal_pcie_ecam_addr(uint32_t seg, uint32_t bus, uint32_t devfn, uint32_t offset)
+{
+    uint32_t i, num = smp_load_acquire(&g_ecam_num_windows);
+    PAL_ECAM_WINDOW *w;
+
+    for (i = 0; i < num; i++) {
+        w = &g_ecam_windows[i];
+        if (w->base && w->segment == seg && bus >= w->start_bus && bus <= w->end_bus)
+            return w->base + (((bus - w->start_bus) << 20) | (devfn << 12) | offset);
+    }
+
+    return NULL;
+}
+
+/**
+  @brief  Reads a naturally aligned config register straight from ECAM
+
+  @param  seg     PCI segment number
+  @param  bus     PCI bus address
+  @param  devfn   PCI device and function
+  @param  offset  register offset in config space
+  @param  len     1, 2 or 4 bytes
+  @param  val     value read
+
+  @return 0 on success, non-zero when the access must use the kernel
+          accessors
+ **/
+int
+pal_pcie_ecam_read(uint32_t seg, uint32_t bus, uint32_t devfn, uint32_t offset,
+                   uint32_t len, uint32_t *val)
+{
+    void __iomem *addr;
+
+    if (offset >= PCI_CFG_SPACE_EXP_SIZE || offset & (len - 1))
+        return 1;
+
+    addr = pal_pcie_ecam_addr(seg, bus, devfn, offset);
+    if (!addr)
+        return 1;
+
+    switch (len) {
+    case 1:
+        *val = readb(addr);
+        break;
+    case 2:
+        *val = readw(addr);
+        break;
+    case 4:
+        *val = readl(addr);
+        break;
+    default:
+        return 1;
+    }
+
+    return 0;
+}
+
+/**
+  @brief  Reads the first size bytes of a function's config space from ECAM,
+          for scans that need all of it
+
+  @param  buf     little endian copy of config space, size bytes
+  @param  size    multiple of 4, at most 4 KB
+
+  @return 0 on success, non-zero when the access must use the kernel
+          accessors
+ **/
+int
+pal_pcie_ecam_read_cfg_space(uint32_t seg, uint32_t bus, uint32_t devfn, uint8_t *buf, uint32_t size)
+{
+    void __iomem *addr;
+    uint32_t pos;
+
+    if (size > PCI_CFG_SPACE_EXP_SIZE || size & 3)
+        return 1;
+
+    addr = pal_pcie_ecam_addr(seg, bus, devfn, 0);
+    if (!addr)
+        return 1;
+
+    for (pos = 0; pos < size; pos += 4)
+        *(__le32 *)&buf[pos] = cpu_to_le32(readl(addr + pos));
+
+    return 0;
+}
+
+/**
+  @brief  Counts the MCFG allocations to size the PCIE Info table
+  @return size of the table in bytes, 0 if there is no MCFG
+ **/
+uint32_t
+pal_pcie_info_table_size(void)
+{
+    struct acpi_table_mcfg *mcfg;
+    uint32_t num_entries;
+
+    mcfg = (struct acpi_table_mcfg *)pal_get_mcfg_ptr();
+    if (!mcfg)
+        return 0;
+
+    /* The create pass always fills in the first allocation */
+    num_entries = 1;
+    if (mcfg->header.length > sizeof(struct acpi_table_mcfg))
+        num_entries = max_t(uint32_t, num_entries,
+                            DIV_ROUND_UP(mcfg->header.length - sizeof(struct acpi_table_mcfg),
+                                         sizeof(struct acpi_mcfg_allocation)));
+
+    return PAL_INFO_TABLE_SIZE(PCIE_INFO_TABLE, block, num_entries);
+}
+
 /**
   @brief  Fill the PCIE Info table with the details of the PCIe sub-system
  **/
@@ -194,6 +387,11 @@ pal_pcie_create_info_table(PCIE_INFO_TABLE *PcieTable)
     struct acpi_table_mcfg      *mcfg;
     struct acpi_mcfg_allocation *entry;
 
+    if (pal_info_table_imported(PcieTable)) {
+        pal_pcie_ecam_map();
+        return;
+    }
+
     length = sizeof(struct acpi_table_mcfg);
 
     PcieTable->num_entries = 0;
@@ -212,6 +410,8 @@ pal_pcie_create_info_table(PCIE_INFO_TABLE *PcieTable)
             i++;
             PcieTable->num_entries++;
         } while((length < mcfg->header.length) && (entry));
+
+        pal_pcie_ecam_map();
 #ifndef BUILD_SBSA
     } else {
         pal_pcie_create_info_table_dt(PcieTable);
@@ -244,13 +444,15 @@ pal_pcie_get_legacy_irq_map(uint32_t seg, uint32_t bus, uint32_t dev, uint32_t f
   uint32_t irq_count;
 
   /* Get a root bridge device */
-  pdev = pci_get_domain_bus_and_slot (seg, bus, PCI_DEVFN (dev, fn));
+  pdev = pal_pci_dev_get(seg, bus, dev, fn);
   if (pdev == NULL || !pdev->bus->bridge) {
+    pci_dev_put(pdev);
     return 1;
   }
 
   /* Get handle for _PRT */
   handle = ACPI_HANDLE (pdev->bus->bridge);
+  pci_dev_put(pdev);
   if (!handle) {
     return 2;
   }
@@ -313,11 +515,15 @@ uint32_t
 pal_pcie_is_device_behind_smmu(uint32_t seg, uint32_t bus, uint32_t dev, uint32_t fn)
 {
   struct pci_dev *pdev;
-  pdev = pci_get_domain_bus_and_slot(seg, bus, PCI_DEVFN(dev, fn));
-  if(pdev->dev.iommu_group)
-      return 1;
-  else
+  uint32_t ret_val;
+
+  pdev = pal_pci_dev_get(seg, bus, dev, fn);
+  if(pdev == NULL)
       return 0;
+
+  ret_val = pdev->dev.iommu_group ? 1 : 0;
+  pci_dev_put(pdev);
+  return ret_val;
 }
 
 /**
@@ -333,16 +539,16 @@ uint32_t
 pal_pcie_is_devicedma_64bit(uint32_t seg, uint32_t bus, uint32_t dev, uint32_t fn)
 {
   struct pci_dev *pdev;
-  pdev = pci_get_domain_bus_and_slot(seg, bus, PCI_DEVFN(dev, fn));
+  uint32_t ret_val = 0;
+  pdev = pal_pci_dev_get(seg, bus, dev, fn);
 
   if (pdev) {
       acs_print(ACS_PRINT_INFO,"dma mask is %llx \n", *pdev->dev.dma_mask);
       if (*pdev->dev.dma_mask == DMA_BIT_MASK(64))
-          return 1;
-      else
-          return 0;
+          ret_val = 1;
+      pci_dev_put(pdev);
   }
-  return 0;
+  return ret_val;
 }
 
 /**
@@ -360,18 +566,19 @@ pal_pcie_device_driver_present(uint32_t seg, uint32_t bus, uint32_t dev, uint32_
   struct pci_dev *pdev;
   struct pci_driver *driver;
 
-  pdev = pci_get_domain_bus_and_slot(seg, bus, PCI_DEVFN(dev, fn));
+  uint32_t ret_val = 0;
+
+  pdev = pal_pci_dev_get(seg, bus, dev, fn);
 
   if (pdev) {
       driver = (*pdev).driver;
       if (driver && driver->name) {
           acs_print(ACS_PRINT_INFO,"driver name is %s \n", *driver->name);
-          return 1;
+          ret_val = 1;
       }
-      else
-          return 0;
+      pci_dev_put(pdev);
   }
-  return 0;
+  return ret_val;
 }
 
 
@@ -390,23 +597,29 @@ uint32_t
 pal_pcie_get_root_port_bdf(uint32_t *seg, uint32_t *bus, uint32_t *dev, uint32_t *func)
 {
   struct pci_dev *pdev, *root_port = NULL;
-  pdev = pci_get_domain_bus_and_slot(*seg, *bus, PCI_DEVFN(*dev, *func));
-  if(pdev->bus->self == NULL)
+  pdev = pal_pci_dev_get(*seg, *bus, *dev, *func);
+  if(pdev == NULL || pdev->bus->self == NULL) {
+    pci_dev_put(pdev);
     return 1;
+  }
 
+  /* The root port is an upstream bridge, kept alive by pdev */
 #if LINUX_VERSION_CODE > KERNEL_VERSION(5,7,0)
   root_port = pcie_find_root_port(pdev);
 #else
   root_port = pci_find_pcie_root_port(pdev);
 #endif
 
-  if(root_port == NULL)
+  if(root_port == NULL) {
+    pci_dev_put(pdev);
     return 2;
+  }
 
   *bus  = root_port->bus->number;
   *dev  = PCI_SLOT(root_port->devfn);
   *func = PCI_FUNC(root_port->devfn);
   *seg  = pci_domain_nr(root_port->bus);
+  pci_dev_put(pdev);
   return 0;
 }
 
@@ -424,11 +637,15 @@ pal_pcie_get_pcie_type(uint32_t seg, uint32_t bus, uint32_t dev, uint32_t fn)
 {
   struct pci_dev *pdev;
 
-  pdev = pci_get_domain_bus_and_slot(seg, bus, PCI_DEVFN(dev, fn));
+  uint32_t ret_val;
+
+  pdev = pal_pci_dev_get(seg, bus, dev, fn);
   if(pdev == NULL)
     return 0;
 
- return pci_pcie_type(pdev);
+  ret_val = pci_pcie_type(pdev);
+  pci_dev_put(pdev);
+  return ret_val;
 }
 
 /**
@@ -448,11 +665,12 @@ pal_pcie_get_snoop_bit(uint32_t seg, uint32_t bus, uint32_t dev, uint32_t fn)
   struct pci_dev *pdev;
   u16 devctl_cap;
   uint32_t ret_val;
-  pdev = pci_get_domain_bus_and_slot(seg, bus, PCI_DEVFN(dev, fn));
+  pdev = pal_pci_dev_get(seg, bus, dev, fn);
   if(pdev == NULL)
     return 2;
 
   pcie_capability_read_word(pdev, PCI_EXP_DEVCTL, &devctl_cap);
+  pci_dev_put(pdev);
   /* Extract bit 11 (no snoop) */
   ret_val = (devctl_cap >> DEVCTL_SNOOP_BIT) & 0x1;
 
@@ -475,11 +693,12 @@ pal_pcie_get_dma_support(uint32_t seg, uint32_t bus, uint32_t dev, uint32_t fn)
 {
   struct pci_dev *pdev;
   uint32_t ret_val;
-  pdev = pci_get_domain_bus_and_slot(seg, bus, PCI_DEVFN(dev, fn));
+  pdev = pal_pci_dev_get(seg, bus, dev, fn);
   if(pdev == NULL)
     return 2;
 
   ret_val = device_dma_supported(&pdev->dev);
+  pci_dev_put(pdev);
 
   return ret_val;
 }
@@ -502,12 +721,13 @@ pal_pcie_get_dma_coherent(uint32_t seg, uint32_t bus, uint32_t dev, uint32_t fn)
   enum dev_dma_attr dma_attr;
   uint32_t ret_val;
 
-  pdev = pci_get_domain_bus_and_slot(seg, bus, PCI_DEVFN(dev, fn));
+  pdev = pal_pci_dev_get(seg, bus, dev, fn);
   if(pdev == NULL)
     return 2;
 
   ret_val = 0;
   dma_attr = device_get_dma_attr(&pdev->dev);
+  pci_dev_put(pdev);
   if (dma_attr == DEV_DMA_COHERENT) {
     ret_val = 1;
   }
@@ -520,21 +740,36 @@ pal_pcie_read_ext_cap_word(uint32_t seg, uint32_t bus, uint32_t dev, uint32_t fn
                            uint32_t ext_cap_id, uint8_t offset, uint16_t *val)
 {
   struct pci_dev *pdev;
+  uint32_t data;
   int pos;
 
-  pdev = pci_get_domain_bus_and_slot(seg, bus, PCI_DEVFN(dev, fn));
+  pdev = pal_pci_dev_get(seg, bus, dev, fn);
   if(pdev == NULL) {
       *val = 0;
       return;
   }
 
-  pos = pci_find_ext_capability(pdev, ext_cap_id);
+  pos = pal_pci_find_ext_cap(pdev, ext_cap_id);
   if (!pos) {
+      pci_dev_put(pdev);
       *val = 0;
       return;
   }
 
-  pci_read_config_word(pdev, pos + offset, val);
+  if (pal_pci_cfg_cache_read(pdev, pos + offset, sizeof(*val), &data) == 0) {
+      pci_dev_put(pdev);
+      *val = data;
+      trace_acs_cfg_read_cached(PCIE_CREATE_BDF(seg, bus, dev, fn), pos + offset,
+                                sizeof(*val), *val);
+      return;
+  }
+
+  if (pal_pcie_ecam_read(seg, bus, PCI_DEVFN(dev, fn), pos + offset, sizeof(*val), &data) == 0)
+      *val = data;
+  else
+      pci_read_config_word(pdev, pos + offset, val);
+  pci_dev_put(pdev);
+  trace_acs_cfg_read(PCIE_CREATE_BDF(seg, bus, dev, fn), pos + offset, sizeof(*val), *val);
 }
 
 /**
@@ -20,10 +20,597 @@
  */
 
 #include <linux/init.h>
+#include <linux/module.h>
 #include <linux/pci.h>
+#include <linux/radix-tree.h>
+#include <linux/spinlock.h>
 
 #include "common/include/pal_pcie_enum.h"
 #include "common/include/pal_linux.h"
+#include "common/include/pal_trace.h"
+
+/* pci_dev of every function seen by the PAL, keyed by segment/bus/devfn.
+   Each entry owns a reference, dropped when the device is removed or the
+   cache is refilled. Once filled from a full walk of the device list the
+   cache is complete and a miss means there is no such function; until then
+   a miss falls back to pci_get_domain_bus_and_slot. */
+static RADIX_TREE(g_pci_dev_cache, GFP_ATOMIC);
+static DEFINE_SPINLOCK(g_pci_dev_cache_lock);
+static bool g_pci_dev_cache_complete;
+
+/* Devices whose DEL notification has been seen since the last fill. The bus
+   keeps handing a device out for a while after that notification, so the
+   next fill is told to skip them. Each one holds a reference so that its
+   pci_dev cannot be reused by a new device in the meantime. */
+typedef struct {
+  struct list_head node;
+  struct pci_dev   *pdev;
+} PAL_PCI_DEV_REMOVED;
+
+static LIST_HEAD(g_pci_dev_removed);
+
+#define PAL_PCI_DEV_KEY(seg, bus, devfn) \
+        (((unsigned long)(seg) << 16) | ((bus) << 8) | (devfn))
+
+static unsigned long
+pal_pci_dev_key(struct pci_dev *pdev)
+{
+  return PAL_PCI_DEV_KEY(pci_domain_nr(pdev->bus), pdev->bus->number, pdev->devfn);
+}
+
+/* Called with g_pci_dev_cache_lock held */
+static bool
+pal_pci_dev_is_removed(struct pci_dev *pdev)
+{
+  PAL_PCI_DEV_REMOVED *removed;
+
+  list_for_each_entry(removed, &g_pci_dev_removed, node)
+      if (removed->pdev == pdev)
+          return true;
+
+  return false;
+}
+
+static void
+pal_pci_dev_removed_free(void)
+{
+  PAL_PCI_DEV_REMOVED *removed, *tmp;
+  unsigned long flags;
+  LIST_HEAD(free_list);
+
+  spin_lock_irqsave(&g_pci_dev_cache_lock, flags);
+  list_splice_init(&g_pci_dev_removed, &free_list);
+  spin_unlock_irqrestore(&g_pci_dev_cache_lock, flags);
+
+  list_for_each_entry_safe(removed, tmp, &free_list, node) {
+      pci_dev_put(removed->pdev);
+      kfree(removed);
+  }
+}
+
+/* Copy of a function's config space, read in one pass the first time the
+   PAL reads it. Only bytes marked in ro are served from the copy: the
+   header identification fields, capability headers and the PCIe
+   capability/link capability registers, none of which software can
+   change. Writes go through to the device and take the written bytes out
+   of ro, so they are read from the device from then on. */
+typedef struct {
+  uint32_t size;
+  uint8_t  data[PCI_CFG_SPACE_EXP_SIZE];
+  DECLARE_BITMAP(ro, PCI_CFG_SPACE_EXP_SIZE);
+} PAL_PCI_CFG_SNAPSHOT;
+
+static RADIX_TREE(g_pci_cfg_cache, GFP_ATOMIC);
+
+static bool g_pci_cfg_cache_enable = true;
+module_param_named(cfg_cache, g_pci_cfg_cache_enable, bool, 0644);
+MODULE_PARM_DESC(cfg_cache, "Serve read-only config registers from a per-device snapshot");
+
+static atomic_long_t g_pci_cfg_cache_hits;
+static atomic_long_t g_pci_cfg_cache_misses;
+
+static int
+pal_pci_cfg_stats_get(char *buffer, const struct kernel_param *kp)
+{
+  return sprintf(buffer, "hits %ld misses %ld\n",
+                 atomic_long_read(&g_pci_cfg_cache_hits),
+                 atomic_long_read(&g_pci_cfg_cache_misses));
+}
+
+static const struct kernel_param_ops pal_pci_cfg_stats_ops = {
+  .get = pal_pci_cfg_stats_get,
+};
+module_param_cb(cfg_cache_stats, &pal_pci_cfg_stats_ops, NULL, 0444);
+MODULE_PARM_DESC(cfg_cache_stats, "Config reads served from the snapshot and from the device");
+
+static void
+pal_pci_cfg_mark_ro(PAL_PCI_CFG_SNAPSHOT *snap, uint32_t pos, uint32_t len)
+{
+  if (pos + len <= snap->size)
+      bitmap_set(snap->ro, pos, len);
+}
+
+static void
+pal_pci_cfg_scan_ro(PAL_PCI_CFG_SNAPSHOT *snap)
+{
+  uint32_t pos, header, ttl;
+  uint8_t id;
+
+  pal_pci_cfg_mark_ro(snap, PCI_VENDOR_ID, 4);
+  pal_pci_cfg_mark_ro(snap, PCI_CLASS_REVISION, 4);
+  pal_pci_cfg_mark_ro(snap, PCI_HEADER_TYPE, 1);
+  pal_pci_cfg_mark_ro(snap, PCI_CAPABILITY_LIST, 1);
+  pal_pci_cfg_mark_ro(snap, PCI_INTERRUPT_PIN, 1);
+  if ((snap->data[PCI_HEADER_TYPE] & 0x7F) == PCI_HEADER_TYPE_NORMAL)
+      pal_pci_cfg_mark_ro(snap, PCI_SUBSYSTEM_VENDOR_ID, 4);
+
+  pos = snap->data[PCI_CAPABILITY_LIST] & ~3;
+  for (ttl = 48; pos >= PCI_STD_HEADER_SIZEOF && ttl; ttl--) {
+      id = snap->data[pos];
+      if (id == 0xFF)
+          break;
+      pal_pci_cfg_mark_ro(snap, pos, 2);
+      if (id == PCI_CAP_ID_EXP) {
+          pal_pci_cfg_mark_ro(snap, pos + PCI_EXP_FLAGS, 2);
+          pal_pci_cfg_mark_ro(snap, pos + PCI_EXP_DEVCAP, 4);
+          pal_pci_cfg_mark_ro(snap, pos + PCI_EXP_LNKCAP, 4);
+          pal_pci_cfg_mark_ro(snap, pos + PCI_EXP_DEVCAP2, 4);
+          pal_pci_cfg_mark_ro(snap, pos + PCI_EXP_LNKCAP2, 4);
+      }
+      pos = snap->data[pos + PCI_CAP_LIST_NEXT] & ~3;
+  }
+
+  if (snap->size <= PCI_CFG_SPACE_SIZE)
+      return;
+
+  pos = PCI_CFG_SPACE_SIZE;
+  for (ttl = (PCI_CFG_SPACE_EXP_SIZE - PCI_CFG_SPACE_SIZE) / 8; ttl; ttl--) {
+      header = le32_to_cpup((__le32 *)&snap->data[pos]);
+      if (header == 0 || header == 0xFFFFFFFF)
+          break;
+      pal_pci_cfg_mark_ro(snap, pos, 4);
+      pos = PCI_EXT_CAP_NEXT(header);
+      if (pos < PCI_CFG_SPACE_SIZE)
+          break;
+  }
+}
+
+static PAL_PCI_CFG_SNAPSHOT *
+pal_pci_cfg_snapshot_take(struct pci_dev *pdev)
+{
+  PAL_PCI_CFG_SNAPSHOT *snap;
+  uint32_t pos, val;
+
+  snap = kzalloc(sizeof(PAL_PCI_CFG_SNAPSHOT), GFP_KERNEL);
+  if (!snap)
+      return NULL;
+
+  snap->size = min_t(uint32_t, pdev->cfg_size, PCI_CFG_SPACE_EXP_SIZE);
+  if (pal_pcie_ecam_read_cfg_space(pci_domain_nr(pdev->bus), pdev->bus->number, pdev->devfn,
+                                   snap->data, snap->size)) {
+      for (pos = 0; pos < snap->size; pos += 4) {
+          if (pci_read_config_dword(pdev, pos, &val)) {
+              kfree(snap);
+              return NULL;
+          }
+          *(__le32 *)&snap->data[pos] = cpu_to_le32(val);
+      }
+  }
+  trace_acs_cfg_read_bulk(pal_pcie_get_bdf(pdev), 0, snap->size);
+
+  /* A function in reset or gone reads all ones, nothing to keep */
+  if (snap->data[PCI_VENDOR_ID] == 0xFF && snap->data[PCI_VENDOR_ID + 1] == 0xFF) {
+      kfree(snap);
+      return NULL;
+  }
+
+  pal_pci_cfg_scan_ro(snap);
+  return snap;
+}
+
+/* Drops the snapshots of the functions with keys first..last */
+static void
+pal_pci_cfg_cache_drop(unsigned long first, unsigned long last)
+{
+  PAL_PCI_CFG_SNAPSHOT *snap;
+  struct radix_tree_iter iter;
+  unsigned long flags;
+  void __rcu **slot;
+
+  do {
+      snap = NULL;
+      spin_lock_irqsave(&g_pci_dev_cache_lock, flags);
+      radix_tree_for_each_slot(slot, &g_pci_cfg_cache, &iter, first) {
+          if (iter.index <= last)
+              snap = radix_tree_delete(&g_pci_cfg_cache, iter.index);
+          break;
+      }
+      spin_unlock_irqrestore(&g_pci_dev_cache_lock, flags);
+      kfree(snap);
+  } while (snap);
+}
+
+/* True if a write of len bytes of val at offset sets bit of the 16-bit
+   register at reg */
+static bool
+pal_pci_cfg_write_sets(uint32_t offset, uint32_t len, uint32_t val, uint32_t reg, uint16_t bit)
+{
+  uint32_t pos = reg + (__ffs(bit) / 8);
+
+  if (pos < offset || pos >= offset + len)
+      return false;
+
+  return (val >> ((pos - offset) * 8)) & (bit >> ((pos - reg) * 8));
+}
+
+/* Called with g_pci_dev_cache_lock held, returns 0 when the bytes were
+   served from the snapshot */
+static int
+pal_pci_cfg_snapshot_read(PAL_PCI_CFG_SNAPSHOT *snap, uint32_t offset, uint32_t len, uint32_t *val)
+{
+  __le32 data = 0;
+
+  if (offset + len > snap->size ||
+      find_next_zero_bit(snap->ro, offset + len, offset) < offset + len)
+      return 1;
+
+  memcpy(&data, &snap->data[offset], len);
+  *val = le32_to_cpu(data);
+  return 0;
+}
+
+/**
+    @brief   Reads len bytes of config space of a function from its snapshot,
+             taking the snapshot on first use
+
+    @return  0 when the read was served, non-zero when it must go to the device
+**/
+int
+pal_pci_cfg_cache_read(struct pci_dev *pdev, uint32_t offset, uint32_t len, uint32_t *val)
+{
+  PAL_PCI_CFG_SNAPSHOT *snap, *new_snap = NULL;
+  unsigned long key = pal_pci_dev_key(pdev);
+  unsigned long flags;
+  bool cached;
+  int ret = 1;
+
+  if (!g_pci_cfg_cache_enable)
+      return 1;
+
+  spin_lock_irqsave(&g_pci_dev_cache_lock, flags);
+  snap = radix_tree_lookup(&g_pci_cfg_cache, key);
+  if (snap)
+      ret = pal_pci_cfg_snapshot_read(snap, offset, len, val);
+  /* Only functions on the BDF cache get a snapshot, it goes with them */
+  cached = radix_tree_lookup(&g_pci_dev_cache, key) == pdev;
+  spin_unlock_irqrestore(&g_pci_dev_cache_lock, flags);
+
+  if (!snap && cached)
+      new_snap = pal_pci_cfg_snapshot_take(pdev);
+
+  if (new_snap && !radix_tree_preload(GFP_KERNEL)) {
+      spin_lock_irqsave(&g_pci_dev_cache_lock, flags);
+      /* The device may have been removed while the snapshot was taken */
+      if (radix_tree_lookup(&g_pci_dev_cache, key) == pdev &&
+          !radix_tree_insert(&g_pci_cfg_cache, key, new_snap))
+          new_snap = NULL;
+      snap = radix_tree_lookup(&g_pci_cfg_cache, key);
+      if (snap)
+          ret = pal_pci_cfg_snapshot_read(snap, offset, len, val);
+      spin_unlock_irqrestore(&g_pci_dev_cache_lock, flags);
+      radix_tree_preload_end();
+  }
+
+  kfree(new_snap);
+
+  if (ret)
+      atomic_long_inc(&g_pci_cfg_cache_misses);
+  else
+      atomic_long_inc(&g_pci_cfg_cache_hits);
+
+  return ret;
+}
+
+/**
+    @brief   Reflects a write to config space in the function's snapshot. The
+             written bytes are no longer served from the snapshot. A write
+             that starts a function level reset, or a secondary bus reset of
+             a bridge, drops the snapshots of the functions it resets.
+**/
+static void
+pal_pci_cfg_cache_write(struct pci_dev *pdev, uint32_t offset, uint32_t len, uint32_t val)
+{
+  PAL_PCI_CFG_SNAPSHOT *snap;
+  unsigned long flags;
+  __le32 data = cpu_to_le32(val);
+  int seg = pci_domain_nr(pdev->bus);
+
+  if (pdev->pcie_cap &&
+      pal_pci_cfg_write_sets(offset, len, val, pdev->pcie_cap + PCI_EXP_DEVCTL, PCI_EXP_DEVCTL_BCR_FLR)) {
+      pal_pci_cfg_cache_drop(pal_pci_dev_key(pdev), pal_pci_dev_key(pdev));
+      return;
+  }
+
+  if (pdev->subordinate &&
+      pal_pci_cfg_write_sets(offset, len, val, PCI_BRIDGE_CONTROL, PCI_BRIDGE_CTL_BUS_RESET)) {
+      pal_pci_cfg_cache_drop(PAL_PCI_DEV_KEY(seg, pdev->subordinate->busn_res.start, 0),
+                             PAL_PCI_DEV_KEY(seg, pdev->subordinate->busn_res.end, 0xFF));
+      return;
+  }
+
+  spin_lock_irqsave(&g_pci_dev_cache_lock, flags);
+  snap = radix_tree_lookup(&g_pci_cfg_cache, pal_pci_dev_key(pdev));
+  if (snap && offset + len <= snap->size) {
+      memcpy(&snap->data[offset], &data, len);
+      bitmap_clear(snap->ro, offset, len);
+  }
+  spin_unlock_irqrestore(&g_pci_dev_cache_lock, flags);
+}
+
+/**
+    @brief   Drops the config space snapshot of a function, so that it is
+             read again from the device, e.g. after a reset
+
+    @param   bdf   function whose snapshot to drop
+**/
+void
+pal_pci_cfg_cache_invalidate(uint32_t bdf)
+{
+  unsigned long key;
+
+  key = PAL_PCI_DEV_KEY(PCIE_EXTRACT_BDF_SEG(bdf), PCIE_EXTRACT_BDF_BUS(bdf),
+                        PCI_DEVFN(PCIE_EXTRACT_BDF_DEV(bdf), PCIE_EXTRACT_BDF_FUNC(bdf)));
+  pal_pci_cfg_cache_drop(key, key);
+}
+
+/* Offsets of the first instance of each extended capability of a function,
+   found with one walk of its extended capability list when it enters the
+   BDF cache. 0 means the function does not have the capability; IDs past
+   the end of the table are looked up in config space. Standard capability
+   lookups are left to the kernel, which already caches the ones the PAL
+   uses (pdev->pcie_cap). */
+#define PAL_PCI_CAP_EXT_NUM  64
+
+typedef struct {
+  uint16_t ext[PAL_PCI_CAP_EXT_NUM];
+} PAL_PCI_CAP_TABLE;
+
+static RADIX_TREE(g_pci_cap_cache, GFP_ATOMIC);
+
+static PAL_PCI_CAP_TABLE *
+pal_pci_cap_table_build(struct pci_dev *pdev)
+{
+  PAL_PCI_CAP_TABLE *caps;
+  uint32_t header, ttl;
+  uint16_t id;
+  int pos;
+
+  caps = kzalloc(sizeof(PAL_PCI_CAP_TABLE), GFP_KERNEL);
+  if (!caps)
+      return NULL;
+
+  if (pdev->cfg_size <= PCI_CFG_SPACE_SIZE)
+      return caps;
+
+  pos = PCI_CFG_SPACE_SIZE;
+  for (ttl = (PCI_CFG_SPACE_EXP_SIZE - PCI_CFG_SPACE_SIZE) / 8; ttl; ttl--) {
+      if (pci_read_config_dword(pdev, pos, &header))
+          break;
+      trace_acs_cfg_read(pal_pcie_get_bdf(pdev), pos, sizeof(header), header);
+      if (header == 0 || header == 0xFFFFFFFF)
+          break;
+      id = PCI_EXT_CAP_ID(header);
+      if (id < PAL_PCI_CAP_EXT_NUM && !caps->ext[id])
+          caps->ext[id] = pos;
+      pos = PCI_EXT_CAP_NEXT(header);
+      if (pos < PCI_CFG_SPACE_SIZE)
+          break;
+  }
+
+  return caps;
+}
+
+/**
+    @brief   Offset of an extended capability of a function
+
+    @param   pdev     function to look in
+    @param   cap_id   PCI_EXT_CAP_ID_*
+
+    @return  offset of the capability, 0 if the function does not have it
+**/
+int
+pal_pci_find_ext_cap(struct pci_dev *pdev, uint32_t cap_id)
+{
+  PAL_PCI_CAP_TABLE *caps;
+  unsigned long flags;
+  int pos = -1;
+
+  spin_lock_irqsave(&g_pci_dev_cache_lock, flags);
+  caps = radix_tree_lookup(&g_pci_cap_cache, pal_pci_dev_key(pdev));
+  if (caps && cap_id < PAL_PCI_CAP_EXT_NUM)
+      pos = caps->ext[cap_id];
+  spin_unlock_irqrestore(&g_pci_dev_cache_lock, flags);
+
+  return pos >= 0 ? pos : pci_find_ext_capability(pdev, cap_id);
+}
+
+/**
+    @brief   Adds a device to the BDF cache, taking a reference on it
+
+    @param   pdev   device to add
+**/
+void
+pal_pci_dev_cache_add(struct pci_dev *pdev)
+{
+  PAL_PCI_CAP_TABLE *caps;
+  unsigned long flags;
+  int ret;
+
+  caps = pal_pci_cap_table_build(pdev);
+
+  if (radix_tree_preload(GFP_KERNEL)) {
+      kfree(caps);
+      return;
+  }
+
+  pci_dev_get(pdev);
+  spin_lock_irqsave(&g_pci_dev_cache_lock, flags);
+  if (pal_pci_dev_is_removed(pdev))
+      ret = -ENODEV;
+  else
+      ret = radix_tree_insert(&g_pci_dev_cache, pal_pci_dev_key(pdev), pdev);
+  /* Without a table, lookups for this function go to config space */
+  if (!ret && caps && !radix_tree_insert(&g_pci_cap_cache, pal_pci_dev_key(pdev), caps))
+      caps = NULL;
+  spin_unlock_irqrestore(&g_pci_dev_cache_lock, flags);
+  radix_tree_preload_end();
+
+  kfree(caps);
+
+  /* -EEXIST when the device is already cached, -ENODEV when it is being
+     removed */
+  if (ret)
+      pci_dev_put(pdev);
+}
+
+/**
+    @brief   Removes a device from the BDF cache and drops its reference
+
+    @param   pdev   device being removed
+**/
+void
+pal_pci_dev_cache_del(struct pci_dev *pdev)
+{
+  PAL_PCI_DEV_REMOVED *removed;
+  PAL_PCI_CFG_SNAPSHOT *snap;
+  PAL_PCI_CAP_TABLE *caps;
+  struct pci_dev *entry;
+  unsigned long flags;
+
+  removed = kmalloc(sizeof(PAL_PCI_DEV_REMOVED), GFP_KERNEL);
+
+  spin_lock_irqsave(&g_pci_dev_cache_lock, flags);
+  entry = radix_tree_delete_item(&g_pci_dev_cache, pal_pci_dev_key(pdev), pdev);
+  snap = radix_tree_delete(&g_pci_cfg_cache, pal_pci_dev_key(pdev));
+  caps = radix_tree_delete(&g_pci_cap_cache, pal_pci_dev_key(pdev));
+  if (removed) {
+      removed->pdev = pci_dev_get(pdev);
+      list_add(&removed->node, &g_pci_dev_removed);
+  }
+  spin_unlock_irqrestore(&g_pci_dev_cache_lock, flags);
+
+  kfree(snap);
+  kfree(caps);
+  if (entry)
+      pci_dev_put(entry);
+}
+
+static void
+pal_pci_dev_cache_flush(void)
+{
+  PAL_PCI_CFG_SNAPSHOT *snap;
+  PAL_PCI_CAP_TABLE *caps;
+  struct radix_tree_iter iter;
+  struct pci_dev *pdev;
+  unsigned long flags;
+  void __rcu **slot;
+
+  for (;;) {
+      pdev = NULL;
+      snap = NULL;
+      caps = NULL;
+      spin_lock_irqsave(&g_pci_dev_cache_lock, flags);
+      g_pci_dev_cache_complete = false;
+      radix_tree_for_each_slot(slot, &g_pci_dev_cache, &iter, 0) {
+          pdev = radix_tree_delete(&g_pci_dev_cache, iter.index);
+          break;
+      }
+      radix_tree_for_each_slot(slot, &g_pci_cfg_cache, &iter, 0) {
+          snap = radix_tree_delete(&g_pci_cfg_cache, iter.index);
+          break;
+      }
+      radix_tree_for_each_slot(slot, &g_pci_cap_cache, &iter, 0) {
+          caps = radix_tree_delete(&g_pci_cap_cache, iter.index);
+          break;
+      }
+      spin_unlock_irqrestore(&g_pci_dev_cache_lock, flags);
+
+      if (!pdev && !snap && !caps)
+          break;
+      kfree(snap);
+      kfree(caps);
+      pci_dev_put(pdev);
+  }
+}
+
+/**
+    @brief   Empties the BDF cache, dropping every reference it holds along
+             with the config space snapshots and capability tables
+**/
+void
+pal_pci_dev_cache_free(void)
+{
+  pal_pci_dev_cache_flush();
+  pal_pci_dev_removed_free();
+}
+
+/**
+    @brief   Fills the BDF cache with every device currently on the PCI bus
+**/
+void
+pal_pci_dev_cache_fill(void)
+{
+  struct pci_dev *pdev = NULL;
+  unsigned long flags;
+
+  pal_pci_dev_cache_flush();
+
+  /* Devices already removed are skipped by pal_pci_dev_cache_add */
+  for_each_pci_dev(pdev)
+      pal_pci_dev_cache_add(pdev);
+
+  spin_lock_irqsave(&g_pci_dev_cache_lock, flags);
+  g_pci_dev_cache_complete = true;
+  spin_unlock_irqrestore(&g_pci_dev_cache_lock, flags);
+
+  /* The walk is over, none of them can be handed out to this fill again */
+  pal_pci_dev_removed_free();
+}
+
+/**
+    @brief   Looks a function up in the BDF cache
+
+    @param   seg        PCI segment number
+    @param   bus        PCI bus address
+    @param   dev        PCI device address
+    @param   fn         PCI function number
+
+    @return  the device with a reference the caller drops with pci_dev_put,
+             NULL if there is no such function
+**/
+struct pci_dev *
+pal_pci_dev_get(uint32_t seg, uint32_t bus, uint32_t dev, uint32_t fn)
+{
+  struct pci_dev *pdev;
+  unsigned long flags;
+  bool complete;
+
+  spin_lock_irqsave(&g_pci_dev_cache_lock, flags);
+  pdev = radix_tree_lookup(&g_pci_dev_cache, PAL_PCI_DEV_KEY(seg, bus, PCI_DEVFN(dev, fn)));
+  if (pdev)
+      pci_dev_get(pdev);
+  complete = g_pci_dev_cache_complete;
+  spin_unlock_irqrestore(&g_pci_dev_cache_lock, flags);
+
+  if (pdev || complete)
+      return pdev;
+
+  pdev = pci_get_domain_bus_and_slot(seg, bus, PCI_DEVFN(dev, fn));
+  if (pdev)
+      pal_pci_dev_cache_add(pdev);
+
+  return pdev;
+}
 
 
 /**
@@ -94,11 +681,17 @@ pal_pcie_get_bdf_wrapper(unsigned int class_code, unsigned int bdf)
       bus = PCIE_EXTRACT_BDF_BUS(bdf);
       dev = PCIE_EXTRACT_BDF_DEV(bdf);
       fn = PCIE_EXTRACT_BDF_FUNC(bdf);
-      pdev = pci_get_domain_bus_and_slot(seg, bus, PCI_DEVFN(dev, fn));
+      pdev = pal_pci_dev_get(seg, bus, dev, fn);
   }
 
+  /* pci_get_class drops the reference on the device it starts from */
   pdev = pal_pci_get_dev(class_code, pdev);
-  return pal_pcie_get_bdf(pdev);
+  if (pdev == NULL)
+      return 0;
+
+  bdf = pal_pcie_get_bdf(pdev);
+  pci_dev_put(pdev);
+  return bdf;
 }
 
 void *
@@ -114,8 +707,9 @@ pal_pci_bdf_to_dev(unsigned int bdf)
   bus = PCIE_EXTRACT_BDF_BUS(bdf);
   dev = PCIE_EXTRACT_BDF_DEV(bdf);
   fn = PCIE_EXTRACT_BDF_FUNC(bdf);
-  pdev = pci_get_domain_bus_and_slot(seg, bus, PCI_DEVFN(dev, fn));
+  pdev = pal_pci_dev_get(seg, bus, dev, fn);
 
+  /* The reference is handed over, callers drop it with put_device */
   if (pdev)
       return ((void *)(&pdev->dev));
 
@@ -129,14 +723,31 @@ void pal_pci_read_config_byte(uint32_t bdf, uint8_t offset, uint8_t *val)
   uint32_t dev;
   uint32_t fn;
   struct pci_dev *pdev;
+  uint32_t data;
 
   seg  = PCIE_EXTRACT_BDF_SEG (bdf);
   bus = PCIE_EXTRACT_BDF_BUS(bdf);
   dev = PCIE_EXTRACT_BDF_DEV(bdf);
   fn = PCIE_EXTRACT_BDF_FUNC(bdf);
-  pdev = pci_get_domain_bus_and_slot(seg, bus, PCI_DEVFN(dev, fn));
+  pdev = pal_pci_dev_get(seg, bus, dev, fn);
+  if (pdev == NULL) {
+      *val = 0xFF;
+      return;
+  }
+
+  if (pal_pci_cfg_cache_read(pdev, offset, sizeof(*val), &data) == 0) {
+      pci_dev_put(pdev);
+      *val = data;
+      trace_acs_cfg_read_cached(bdf, offset, sizeof(*val), *val);
+      return;
+  }
 
-  pci_read_config_byte(pdev, offset, val);
+  if (pal_pcie_ecam_read(seg, bus, PCI_DEVFN(dev, fn), offset, sizeof(*val), &data) == 0)
+      *val = data;
+  else
+      pci_read_config_byte(pdev, offset, val);
+  pci_dev_put(pdev);
+  trace_acs_cfg_read(bdf, offset, sizeof(*val), *val);
 }
 
 void pal_pci_write_config_byte(uint32_t bdf, uint8_t offset, uint8_t val)
@@ -151,9 +762,14 @@ void pal_pci_write_config_byte(uint32_t bdf, uint8_t offset, uint8_t val)
   bus = PCIE_EXTRACT_BDF_BUS(bdf);
   dev = PCIE_EXTRACT_BDF_DEV(bdf);
   fn = PCIE_EXTRACT_BDF_FUNC(bdf);
-  pdev = pci_get_domain_bus_and_slot(seg, bus, PCI_DEVFN(dev, fn));
+  pdev = pal_pci_dev_get(seg, bus, dev, fn);
+  if (pdev == NULL)
+      return;
 
   pci_write_config_byte(pdev, offset, val);
+  pal_pci_cfg_cache_write(pdev, offset, sizeof(val), val);
+  pci_dev_put(pdev);
+  trace_acs_cfg_write(bdf, offset, sizeof(val), val);
 }
 
 /**
@@ -177,10 +793,12 @@ pal_pcie_check_device_valid(unsigned int bdf)
   bus = PCIE_EXTRACT_BDF_BUS(bdf);
   dev = PCIE_EXTRACT_BDF_DEV(bdf);
   fn = PCIE_EXTRACT_BDF_FUNC(bdf);
-  pdev = pci_get_domain_bus_and_slot(seg, bus, PCI_DEVFN(dev, fn));
+  pdev = pal_pci_dev_get(seg, bus, dev, fn);
 
-  if (pdev)
+  if (pdev) {
+      pci_dev_put(pdev);
       return 0;
+  }
 
   return 1;
 
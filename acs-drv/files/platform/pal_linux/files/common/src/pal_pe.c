@@ -27,6 +27,35 @@
 #include <acpi/actbl1.h>
 #include "bsa/include/bsa_pal_dt.h"
 
+/**
+  @brief  Counts the GICC entries of the MADT to size the PE_INFO Table.
+
+  @return  Size of the table in bytes, 0 if there is no MADT
+**/
+uint32_t
+pal_pe_info_table_size(void)
+{
+  unsigned int                       length, num_pe = 0;
+  struct acpi_table_madt             *madt;
+  struct acpi_subtable_header        *entry;
+
+  madt = (struct acpi_table_madt *)pal_get_madt_ptr();
+  if (!madt)
+      return 0;
+
+  length = sizeof(struct acpi_table_madt);
+  entry = (struct acpi_subtable_header *) &madt[1];
+
+  while (length < madt->header.length && entry->length) {
+      if (entry->type == ACPI_MADT_TYPE_GENERIC_INTERRUPT)
+          num_pe++;
+      length += entry->length;
+      entry = (struct acpi_subtable_header *) ((u8 *)entry + entry->length);
+  }
+
+  return PAL_INFO_TABLE_SIZE(PE_INFO_TABLE, pe_info, num_pe);
+}
+
 /**
   @brief  This API fills in the PE_INFO Table with information about the PEs in the
           system. This is achieved by parsing the ACPI - MADT table.
@@ -43,6 +72,9 @@ pal_pe_create_info_table(PE_INFO_TABLE *PeTable)
   struct acpi_table_madt             *madt;
   struct acpi_madt_generic_interrupt *entry;
 
+  if (pal_info_table_imported(PeTable))
+      return;
+
   /* initialise number of PEs to zero */
   PeTable->header.num_of_pe = 0;
 
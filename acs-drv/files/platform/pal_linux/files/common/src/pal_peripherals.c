@@ -39,6 +39,31 @@
 void
 pal_peripheral_create_dma_table(void);
 
+/* Blocks, end marker included, the table was last sized for. 0 if it
+   was not sized. */
+static uint32_t g_per_table_max;
+
+/**
+  @brief  Counts the PCI devices to size the peripheral info table. Devices
+          added after this pass are left out of the table being built.
+
+  @return size of the table in bytes
+**/
+uint32_t
+pal_peripheral_info_table_size(void)
+{
+  struct pci_dev *pdev = NULL;
+  uint32_t num_dev = 0;
+
+  for_each_pci_dev(pdev)
+      num_dev++;
+
+  /* One more block for the end of table marker */
+  g_per_table_max = num_dev + 1;
+
+  return PAL_INFO_TABLE_SIZE(PERIPHERAL_INFO_TABLE, info, g_per_table_max);
+}
+
 void
 pal_peripheral_create_info_table(PERIPHERAL_INFO_TABLE *peripheralInfoTable)
 {
@@ -49,6 +74,12 @@ pal_peripheral_create_info_table(PERIPHERAL_INFO_TABLE *peripheralInfoTable)
 
   per_info = peripheralInfoTable->info;
 
+  /* Every per-device PAL helper looks its pci_dev up from here on */
+  pal_pci_dev_cache_fill();
+
+  if (pal_info_table_imported(peripheralInfoTable))
+      return;
+
   peripheralInfoTable->header.num_usb = 0;
   peripheralInfoTable->header.num_sata = 0;
   peripheralInfoTable->header.num_uart = 0;
@@ -57,6 +88,11 @@ pal_peripheral_create_info_table(PERIPHERAL_INFO_TABLE *peripheralInfoTable)
   /* Collect all PCI devices */
   do {
        pdev = pal_pci_get_dev_next (pdev);
+       if (pdev != NULL && g_per_table_max &&
+           peripheralInfoTable->header.num_all + 1 == g_per_table_max) {
+         pci_dev_put(pdev);
+         break;
+       }
        if (pdev != NULL) {
          per_info->base0 = pal_pcie_get_base (pdev, BAR0);
          per_info->bdf = pal_pcie_get_bdf (pdev);
@@ -111,15 +147,15 @@ pal_peripheral_create_info_table(PERIPHERAL_INFO_TABLE *peripheralInfoTable)
 uint32_t pal_peripheral_is_pcie(uint32_t seg, uint32_t bus, uint32_t dev, uint32_t fn)
 {
     struct pci_dev *pdev;
+    uint32_t ret_val;
 
-    pdev = pci_get_domain_bus_and_slot(seg, bus, PCI_DEVFN(dev, fn));
+    pdev = pal_pci_dev_get(seg, bus, dev, fn);
     if (pdev == NULL)
         return 0;
 
-    if (pci_is_pcie(pdev))
-        return 1;
-    else
-        return 0;
+    ret_val = pci_is_pcie(pdev) ? 1 : 0;
+    pci_dev_put(pdev);
+    return ret_val;
 }
 
 unsigned long long
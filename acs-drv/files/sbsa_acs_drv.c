@@ -20,24 +20,36 @@
  */
 
 #include <linux/version.h>
+#include <linux/ktime.h>
+#include <linux/async.h>
+#include <linux/bitmap.h>
+#include <linux/cpuhotplug.h>
+#include <linux/jhash.h>
+#include <linux/pci.h>
+#include <linux/miscdevice.h>
+#include <linux/mm.h>
+#include <linux/mutex.h>
+#include <linux/poll.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
 #include "sbsa_acs_drv.h"
+#include "platform/pal_linux/files/common/include/pal_msg.h"
+#include "platform/pal_linux/files/common/include/pal_trace.h"
 
+#include "val/common/include/pal_interface.h"
 #include "val/common/include/val_interface.h"
 #include "val/common/include/acs_val.h"
 #include "val/common/include/acs_common.h"
 #include "val/sbsa/include/sbsa_acs_pcie.h"
 #include "val/sbsa/include/sbsa_val_interface.h"
 
-test_params_t params;
 test_msg_parms_t msg_params;
 
-static int len = 0;
-
 unsigned int  g_sbsa_level = 4;
 unsigned int  g_sbsa_only_level = 0;
 unsigned int  g_print_level = 3;
 unsigned int  *g_skip_test_num;
-unsigned int  g_num_skip = 3;
+unsigned int  g_num_skip;
 unsigned int  *g_execute_tests;
 unsigned int  *g_execute_modules;
 unsigned int  g_acs_tests_total;
@@ -57,98 +69,609 @@ unsigned int g_specific_modules[] = {};
 uint32_t  g_num_tests        = sizeof(g_specific_tests)/sizeof(unsigned int);
 uint32_t  g_num_modules      = sizeof(g_specific_modules)/sizeof(unsigned int);
 
+/* Runtime selection of tests and modules. tests= and modules= take a list
+   such as "801,805-807" at load time or through
+   /sys/module/sbsa_acs/parameters/; while a list is empty the arrays above
+   are used. The bitmaps are expanded into the arrays VAL reads before the
+   next command runs. */
+#define ACS_MAX_SEL_ID 4096
+
+static DECLARE_BITMAP(g_test_sel, ACS_MAX_SEL_ID);
+static DECLARE_BITMAP(g_module_sel, ACS_MAX_SEL_ID);
+static DEFINE_MUTEX(g_sel_lock);
+static unsigned int g_sel_gen;
+static unsigned int g_sel_applied_gen;
+static unsigned int *g_sel_tests;
+static unsigned int *g_sel_modules;
+static uint32_t g_sel_num_tests;
+static uint32_t g_sel_num_modules;
+
+static int
+val_glue_sel_set(const char *val, const struct kernel_param *kp)
+{
+    unsigned long *sel = kp->arg;
+    unsigned long *tmp;
+    char *list;
+    int ret;
+
+    list = kstrdup(val, GFP_KERNEL);
+    tmp = bitmap_zalloc(ACS_MAX_SEL_ID, GFP_KERNEL);
+    if (!list || !tmp) {
+        ret = -ENOMEM;
+        goto out;
+    }
+
+    ret = bitmap_parselist(strim(list), tmp, ACS_MAX_SEL_ID);
+    if (ret)
+        goto out;
+
+    mutex_lock(&g_sel_lock);
+    bitmap_copy(sel, tmp, ACS_MAX_SEL_ID);
+    g_sel_gen++;
+    mutex_unlock(&g_sel_lock);
+
+out:
+    bitmap_free(tmp);
+    kfree(list);
+    return ret;
+}
+
+static int
+val_glue_sel_get(char *buffer, const struct kernel_param *kp)
+{
+    unsigned long *sel = kp->arg;
+    int ret;
+
+    mutex_lock(&g_sel_lock);
+    ret = scnprintf(buffer, PAGE_SIZE, "%*pbl\n", ACS_MAX_SEL_ID, sel);
+    mutex_unlock(&g_sel_lock);
+
+    return ret;
+}
+
+static const struct kernel_param_ops val_glue_sel_ops = {
+    .set = val_glue_sel_set,
+    .get = val_glue_sel_get,
+};
+
+module_param_cb(tests, &val_glue_sel_ops, g_test_sel, 0644);
+MODULE_PARM_DESC(tests, "Run only these test IDs, e.g. 801,805-807");
+module_param_cb(modules, &val_glue_sel_ops, g_module_sel, 0644);
+MODULE_PARM_DESC(modules, "Run only these module IDs");
+
+static unsigned int *
+val_glue_sel_expand(unsigned long *sel, uint32_t *num)
+{
+    unsigned int *ids;
+    unsigned int bit;
+    uint32_t i = 0;
+
+    *num = bitmap_weight(sel, ACS_MAX_SEL_ID);
+    if (!*num)
+        return NULL;
+
+    ids = kmalloc_array(*num, sizeof(*ids), GFP_KERNEL);
+    if (!ids) {
+        *num = 0;
+        return NULL;
+    }
+
+    for_each_set_bit(bit, sel, ACS_MAX_SEL_ID)
+        ids[i++] = bit;
+
+    return ids;
+}
+
+/* Points VAL at the current selection, called with g_exec_lock held */
+static void
+val_glue_apply_selection(void)
+{
+    mutex_lock(&g_sel_lock);
+    if (g_sel_applied_gen != g_sel_gen) {
+        kfree(g_sel_tests);
+        kfree(g_sel_modules);
+        g_sel_tests = val_glue_sel_expand(g_test_sel, &g_sel_num_tests);
+        g_sel_modules = val_glue_sel_expand(g_module_sel, &g_sel_num_modules);
+        g_sel_applied_gen = g_sel_gen;
+    }
+    mutex_unlock(&g_sel_lock);
+
+    if (g_sel_num_tests) {
+        g_execute_tests = g_sel_tests;
+        g_num_tests = g_sel_num_tests;
+    } else {
+        g_execute_tests = g_specific_tests;
+        g_num_tests = sizeof(g_specific_tests)/sizeof(unsigned int);
+    }
+
+    if (g_sel_num_modules) {
+        g_execute_modules = g_sel_modules;
+        g_num_modules = g_sel_num_modules;
+    } else {
+        g_execute_modules = g_specific_modules;
+        g_num_modules = sizeof(g_specific_modules)/sizeof(unsigned int);
+    }
+}
+
 uint64_t  *g_pe_info_ptr;
 uint64_t  *g_pcie_info_ptr;
 uint64_t  *g_per_info_ptr;
 uint64_t  *g_iovirt_info_ptr;
 
-char *g_msg_buf;
-int tail_msg;
-extern int num_msg;
-int val_glue_execute_command(void);
+static pal_result_t g_result;
 
-int
-val_glue_execute_command(void)
+/* State of one client of the driver. /proc/sbsa keeps the single session the
+   user application has always driven, each open of /dev/sbsa gets its own.
+   The info tables are shared by every session that created them and freed
+   when the last one lets go.
+
+   Sessions isolate configuration only, they do not run in parallel. VAL
+   keeps its run state (test counters, per-PE status, print level, skip
+   list and SW view in use) in globals and is not reentrant, so commands
+   from every session are serialised on g_exec_wq and g_exec_lock. The
+   test counters and the result records are those of the run as a whole:
+   when several clients execute modules in one run, what each reads back
+   covers the modules of all of them. */
+typedef struct {
+    struct mutex          lock;         /* params and pending */
+    test_params_t         params;
+    DECLARE_BITMAP(skip, ACS_MAX_SEL_ID);
+    unsigned int          *skip_ids;    /* skip expanded for VAL */
+    uint32_t              num_skip;
+    bool                  skip_dirty;
+    bool                  tables_held;
+    bool                  pending;
+    struct work_struct    work;
+    test_progress_t       base;
+    uint64_t              start_ns;
+    uint64_t              end_ns;
+    unsigned int          api_num;
+} val_glue_session_t;
+
+int val_glue_execute_command(val_glue_session_t *s, test_params_t *p);
+
+/* Execute commands written to /proc/sbsa run on g_exec_wq so the writer
+   returns at once and the user application sees DRV_STATUS_PENDING until
+   the run completes; pending is only cleared once the run has finished.
+   The queue is ordered, so one command executes at a time. */
+static struct workqueue_struct *g_exec_wq;
+static DEFINE_MUTEX(g_exec_lock);
+static DECLARE_WAIT_QUEUE_HEAD(g_exec_wait);
+static val_glue_session_t g_proc_session;
+static unsigned int g_tables_refs;  /* protected by g_exec_lock */
+
+/* The info tables stay resident once built and are only rebuilt by the
+   next CREATE_INFO_TABLES after an event has invalidated them: PCI device
+   add/remove and driver bind/unbind for the tables discovered from PCI
+   (which covers PCI attached SCSI/SATA hosts), PCI device add/remove also
+   for the PCIe table, which VAL enumerates its BDF table with, and CPU
+   hotplug for the PE table. The IORT table is read from firmware and does
+   not follow hotplug. A clear bit in g_tables_valid marks a table to
+   rebuild. */
+enum {
+    VAL_GLUE_TBL_PE      = SBSA_SNAPSHOT_PE,
+    VAL_GLUE_TBL_PCIE    = SBSA_SNAPSHOT_PCIE,
+    VAL_GLUE_TBL_PER     = SBSA_SNAPSHOT_PER,
+    VAL_GLUE_TBL_IOVIRT  = SBSA_SNAPSHOT_IOVIRT,
+    VAL_GLUE_TBL_NUM,
+};
+
+static uint64_t **const g_tables_ptr[VAL_GLUE_TBL_NUM] = {
+    [VAL_GLUE_TBL_PE]      = &g_pe_info_ptr,
+    [VAL_GLUE_TBL_PCIE]    = &g_pcie_info_ptr,
+    [VAL_GLUE_TBL_PER]     = &g_per_info_ptr,
+    [VAL_GLUE_TBL_IOVIRT]  = &g_iovirt_info_ptr,
+};
+static uint32_t g_tables_size[VAL_GLUE_TBL_NUM];
+
+static unsigned long g_tables_valid;
+static enum cpuhp_state g_tables_cpuhp;
+static bool g_shared_mem;           /* protected by g_exec_lock */
+
+/* Called with s->lock held */
+static void
+val_glue_exec_begin(val_glue_session_t *s, unsigned int api_num)
 {
-    uint32_t status = 0;
-    g_print_level = params.arg1;
-    if (g_num_tests) {
-        g_execute_tests = g_specific_tests;
+    s->api_num         = api_num;
+    s->base.tests_run  = g_acs_tests_total;
+    s->base.tests_pass = g_acs_tests_pass;
+    s->base.tests_fail = g_acs_tests_fail;
+    s->start_ns        = ktime_get_ns();
+    s->pending         = true;
+}
+
+static void
+val_glue_exec_end(val_glue_session_t *s)
+{
+    mutex_lock(&s->lock);
+    s->end_ns  = ktime_get_ns();
+    s->pending = false;
+    mutex_unlock(&s->lock);
+    wake_up_interruptible(&g_exec_wait);
+}
+
+static int
+val_glue_execute_locked(val_glue_session_t *s, test_params_t *p)
+{
+    int status;
+
+    trace_acs_cmd_begin(p->api_num, p->level, p->num_pe);
+    mutex_lock(&g_exec_lock);
+    status = val_glue_execute_command(s, p);
+    mutex_unlock(&g_exec_lock);
+    trace_acs_cmd_end(p->api_num, p->arg1);
+
+    return status;
+}
+
+static void
+val_glue_execute_work(struct work_struct *work)
+{
+    val_glue_session_t *s = container_of(work, val_glue_session_t, work);
+
+    val_glue_execute_locked(s, &s->params);
+    val_glue_exec_end(s);
+}
+
+static void
+val_glue_session_init(val_glue_session_t *s)
+{
+    mutex_init(&s->lock);
+    INIT_WORK(&s->work, val_glue_execute_work);
+}
+
+/* Drops what the session still holds once its client has gone */
+static void
+val_glue_session_release(val_glue_session_t *s)
+{
+    mutex_lock(&g_exec_lock);
+    if (g_skip_test_num == s->skip_ids) {
+        g_skip_test_num = NULL;
+        g_num_skip = 0;
     }
+    kfree(s->skip_ids);
+    s->skip_ids = NULL;
 
-    if (g_num_modules) {
-        g_execute_modules = g_specific_modules;
+    if (s->tables_held) {
+        s->tables_held = false;
+        if (--g_tables_refs == 0)
+            pal_mmio_map_cache_free();
     }
+    mutex_unlock(&g_exec_lock);
+}
 
-    if (params.api_num == SBSA_CREATE_INFO_TABLES)
-    {
-        g_acs_tests_total = 0;
-        g_acs_tests_pass = 0;
-        g_acs_tests_fail = 0;
-        tail_msg = 0;
+/* Adds tests first..last to the skip list of the session, or removes them */
+static void
+val_glue_skip_update(val_glue_session_t *s, unsigned long first, unsigned long last, bool skip)
+{
+    if (first > last || first >= ACS_MAX_SEL_ID)
+        return;
+
+    last = min_t(unsigned long, last, ACS_MAX_SEL_ID - 1);
+    if (skip)
+        bitmap_set(s->skip, first, last - first + 1);
+    else
+        bitmap_clear(s->skip, first, last - first + 1);
+    s->skip_dirty = true;
+}
+
+/* Hands the skip list of the session to VAL, called with g_exec_lock held */
+static void
+val_glue_apply_skip(val_glue_session_t *s)
+{
+    if (s->skip_dirty) {
+        kfree(s->skip_ids);
+        s->skip_ids = val_glue_sel_expand(s->skip, &s->num_skip);
+        s->skip_dirty = false;
+    }
+
+    g_skip_test_num = s->skip_ids;
+    g_num_skip = s->num_skip;
+}
+
+static bool
+val_glue_is_execute(unsigned int api_num)
+{
+    switch (api_num) {
+    case SBSA_SMMU_EXECUTE_TEST:
+    case SBSA_PCIE_EXECUTE_TEST:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/* Called with s->lock held */
+static void
+val_glue_get_progress(val_glue_session_t *s, test_progress_t *progress)
+{
+    progress->api_num     = s->api_num;
+    progress->status      = s->pending ? DRV_STATUS_PENDING : DRV_STATUS_AVAILABLE;
+    progress->curr_module = READ_ONCE(g_curr_module);
+    progress->tests_run   = READ_ONCE(g_acs_tests_total) - s->base.tests_run;
+    progress->tests_pass  = READ_ONCE(g_acs_tests_pass) - s->base.tests_pass;
+    progress->tests_fail  = READ_ONCE(g_acs_tests_fail) - s->base.tests_fail;
+    progress->elapsed_ns  = (s->pending ? ktime_get_ns() : s->end_ns) - s->start_ns;
+}
+
+static void
+val_glue_result_begin(uint32_t module, uint32_t num_pe)
+{
+    trace_acs_module_begin(module, num_pe);
+    g_result.start_ns   = ktime_get_ns();
+    g_result.pe         = raw_smp_processor_id();
+    g_result.tests_run  = g_acs_tests_total;
+    g_result.tests_pass = g_acs_tests_pass;
+    g_result.tests_fail = g_acs_tests_fail;
+}
+
+static void
+val_glue_result_end(uint32_t module)
+{
+    g_result.end_ns     = ktime_get_ns();
+    g_result.module     = module;
+    g_result.test_id    = 0;
+    g_result.tests_run  = g_acs_tests_total - g_result.tests_run;
+    g_result.tests_pass = g_acs_tests_pass - g_result.tests_pass;
+    g_result.tests_fail = g_acs_tests_fail - g_result.tests_fail;
+    g_result.error      = val_get_status(0);
+
+    if (g_result.tests_fail)
+        g_result.status = PAL_RESULT_FAIL;
+    else if (!g_result.tests_run)
+        g_result.status = PAL_RESULT_SKIP;
+    else
+        g_result.status = PAL_RESULT_PASS;
+
+    trace_acs_module_end(module, g_result.status, g_result.tests_run,
+                         g_result.tests_pass, g_result.tests_fail);
+    pal_msg_result_put(&g_result);
+}
+
+/* Tables are allocated at the size the PAL finds for this system, falling
+   back to the fixed size when it cannot tell. Large ones such as the IORT
+   table on big systems end up vmalloc'ed. */
+static void
+val_glue_alloc_table(unsigned int table, uint32_t size, uint32_t fallback)
+{
+    uint64_t **ptr = g_tables_ptr[table];
+
+    if (!size)
+        size = fallback;
+
+    kvfree(*ptr);
+    *ptr = kvzalloc(size, GFP_KERNEL);
+    g_tables_size[table] = *ptr ? size : 0;
+}
+
+/* The PE shared memory is sized by the PE table, so it is reallocated each
+   time that table is rebuilt. Called with g_exec_lock held. */
+static void
+val_glue_alloc_shared_mem(void)
+{
+    if (g_shared_mem)
+        val_free_shared_mem();
+    val_allocate_shared_mem();
+    g_shared_mem = true;
+}
+
+/* Called at module exit, once no session is left */
+static void
+val_glue_free_info_tables(void)
+{
+    unsigned int i;
+
+    if (g_shared_mem) {
+        val_free_shared_mem();
+        g_shared_mem = false;
+    }
+
+    for (i = 0; i < VAL_GLUE_TBL_NUM; i++) {
+        kvfree(*g_tables_ptr[i]);
+        *g_tables_ptr[i] = NULL;
+        g_tables_size[i] = 0;
+    }
+    g_tables_valid = 0;
+}
+
+/* The peripheral and IORT tables do not depend on each other and each
+   can take a while to discover, so they are built concurrently once the PE
+   and PCIe tables are in place. */
+static bool g_parallel_tables = true;
+module_param_named(parallel_tables, g_parallel_tables, bool, 0644);
+MODULE_PARM_DESC(parallel_tables, "Build independent info tables concurrently");
 
-        g_msg_buf = (char*) kmalloc(num_msg * sizeof(test_msg_parms_t), GFP_KERNEL);
+static ASYNC_DOMAIN_EXCLUSIVE(g_tables_domain);
 
-        g_pe_info_ptr = kmalloc(PE_INFO_TBL_SZ, GFP_KERNEL);
+static void
+val_glue_build_table(void *data, async_cookie_t cookie)
+{
+    switch ((unsigned long)data) {
+    case VAL_GLUE_TBL_PER:
+        val_glue_alloc_table(VAL_GLUE_TBL_PER, pal_peripheral_info_table_size(), PERIPHERAL_INFO_TBL_SZ);
+        val_peripheral_create_info_table(g_per_info_ptr);
+        break;
+    case VAL_GLUE_TBL_IOVIRT:
+        val_glue_alloc_table(VAL_GLUE_TBL_IOVIRT, pal_iovirt_info_table_size(), IOVIRT_INFO_TBL_SZ);
+        val_iovirt_create_info_table(g_iovirt_info_ptr);
+        break;
+    }
+}
+
+static void
+val_glue_schedule_table(unsigned long table)
+{
+    if (g_parallel_tables)
+        async_schedule_domain(val_glue_build_table, (void *)table, &g_tables_domain);
+    else
+        val_glue_build_table((void *)table, 0);
+}
+
+/* Builds the info tables that are missing or were invalidated, called with
+   g_exec_lock held. */
+static uint32_t
+val_glue_create_info_tables(void)
+{
+    uint32_t status;
+
+    if (!test_and_set_bit(VAL_GLUE_TBL_PE, &g_tables_valid)) {
+        val_glue_alloc_table(VAL_GLUE_TBL_PE, pal_pe_info_table_size(), PE_INFO_TBL_SZ);
         status = val_pe_create_info_table(g_pe_info_ptr);
         if (status) {
-            params.arg0 = DRV_STATUS_AVAILABLE;
-            params.arg1 = status;
-            return 1;
+            kvfree(g_pe_info_ptr);
+            g_pe_info_ptr = NULL;
+            g_tables_size[VAL_GLUE_TBL_PE] = 0;
+            clear_bit(VAL_GLUE_TBL_PE, &g_tables_valid);
+            return status;
         }
-        g_pcie_info_ptr = kmalloc(PCIE_INFO_TBL_SZ, GFP_KERNEL);
+        val_glue_alloc_shared_mem();
+    }
+
+    if (!test_and_set_bit(VAL_GLUE_TBL_PCIE, &g_tables_valid)) {
+        val_glue_alloc_table(VAL_GLUE_TBL_PCIE, pal_pcie_info_table_size(), PCIE_INFO_TBL_SZ);
         val_pcie_create_info_table(g_pcie_info_ptr);
+    }
 
-        g_per_info_ptr = kmalloc(PERIPHERAL_INFO_TBL_SZ, GFP_KERNEL);
-        val_peripheral_create_info_table(g_per_info_ptr);
+    if (!test_and_set_bit(VAL_GLUE_TBL_PER, &g_tables_valid))
+        val_glue_schedule_table(VAL_GLUE_TBL_PER);
 
-        g_iovirt_info_ptr = kmalloc(IOVIRT_INFO_TBL_SZ, GFP_KERNEL);
-        val_iovirt_create_info_table(g_iovirt_info_ptr);
+    if (!test_and_set_bit(VAL_GLUE_TBL_IOVIRT, &g_tables_valid))
+        val_glue_schedule_table(VAL_GLUE_TBL_IOVIRT);
+
+    async_synchronize_full_domain(&g_tables_domain);
+    return 0;
+}
+
+static int
+val_glue_pci_notify(struct notifier_block *nb, unsigned long action, void *data)
+{
+    struct pci_dev *pdev = to_pci_dev(data);
 
-        val_allocate_shared_mem();
+    if (action == BUS_NOTIFY_ADD_DEVICE)
+        pal_pci_dev_cache_add(pdev);
+    else if (action == BUS_NOTIFY_DEL_DEVICE)
+        pal_pci_dev_cache_del(pdev);
 
-        params.arg0 = DRV_STATUS_AVAILABLE;
-        params.arg1 = 0;
+    if (action == BUS_NOTIFY_ADD_DEVICE || action == BUS_NOTIFY_DEL_DEVICE)
+        clear_bit(VAL_GLUE_TBL_PCIE, &g_tables_valid);
 
+    /* A new function at a known BDF, or a driver probing or releasing one,
+       which commonly resets it, invalidates what was read from it */
+    if (action == BUS_NOTIFY_ADD_DEVICE || action == BUS_NOTIFY_BOUND_DRIVER ||
+        action == BUS_NOTIFY_UNBOUND_DRIVER)
+        pal_pci_cfg_cache_invalidate(pal_pcie_get_bdf(pdev));
+
+    switch (action) {
+    case BUS_NOTIFY_ADD_DEVICE:
+    case BUS_NOTIFY_DEL_DEVICE:
+    case BUS_NOTIFY_BOUND_DRIVER:
+    case BUS_NOTIFY_UNBOUND_DRIVER:
+        clear_bit(VAL_GLUE_TBL_PER, &g_tables_valid);
+        break;
     }
 
-    if (params.api_num == SBSA_FREE_INFO_TABLES)
+    return NOTIFY_DONE;
+}
+
+static struct notifier_block g_tables_pci_nb = {
+    .notifier_call = val_glue_pci_notify,
+};
+
+static int
+val_glue_cpu_notify(unsigned int cpu)
+{
+    clear_bit(VAL_GLUE_TBL_PE, &g_tables_valid);
+    return 0;
+}
+
+/* Called with g_exec_lock held */
+int
+val_glue_execute_command(val_glue_session_t *s, test_params_t *p)
+{
+    uint32_t status = 0;
+    g_print_level = p->arg1;
+    pal_print_set_level(g_print_level);
+    val_glue_apply_skip(s);
+    val_glue_apply_selection();
+
+    if (p->api_num == SBSA_CREATE_INFO_TABLES)
     {
-        kfree(g_pe_info_ptr);
-        kfree(g_pcie_info_ptr);
-        kfree(g_per_info_ptr);
-        kfree(g_iovirt_info_ptr);
-        kfree(g_msg_buf);
-        kfree(g_skip_test_num);
+        /* First client of a new run */
+        if (!g_tables_refs) {
+            g_acs_tests_total = 0;
+            g_acs_tests_pass = 0;
+            g_acs_tests_fail = 0;
+            pal_msg_reset();
+        }
 
+        status = val_glue_create_info_tables();
+        if (status) {
+            p->arg0 = DRV_STATUS_AVAILABLE;
+            p->arg1 = status;
+            return 1;
+        }
+
+        if (!s->tables_held) {
+            s->tables_held = true;
+            g_tables_refs++;
+        }
+        p->arg0 = DRV_STATUS_AVAILABLE;
+        p->arg1 = 0;
+    }
+
+    if (p->api_num == SBSA_FREE_INFO_TABLES && s->tables_held)
+    {
+        s->tables_held = false;
+        if (--g_tables_refs == 0)
+            pal_mmio_map_cache_free();
     }
 
-    if (params.api_num == SBSA_SMMU_EXECUTE_TEST)
+    if (p->api_num == SBSA_SMMU_EXECUTE_TEST)
     {
-        params.arg0 = DRV_STATUS_PENDING;
-        val_sbsa_smmu_execute_tests(params.level, params.num_pe);
-        params.arg0 = DRV_STATUS_AVAILABLE;
-        params.arg1 = val_get_status(0);
+        p->arg0 = DRV_STATUS_PENDING;
+        pal_msg_set_active(true);
+        val_glue_result_begin(SBSA_SMMU_EXECUTE_TEST, p->num_pe);
+        val_sbsa_smmu_execute_tests(p->level, p->num_pe);
+        val_glue_result_end(SBSA_SMMU_EXECUTE_TEST);
+        pal_msg_set_active(false);
+        p->arg0 = DRV_STATUS_AVAILABLE;
+        p->arg1 = val_get_status(0);
     }
 
-    if (params.api_num == SBSA_PCIE_EXECUTE_TEST)
+    if (p->api_num == SBSA_PCIE_EXECUTE_TEST)
     {
-        params.arg0 = DRV_STATUS_PENDING;
-        val_sbsa_pcie_execute_tests(params.level, params.num_pe);
+        p->arg0 = DRV_STATUS_PENDING;
+        pal_msg_set_active(true);
+        val_glue_result_begin(SBSA_PCIE_EXECUTE_TEST, p->num_pe);
+        val_sbsa_pcie_execute_tests(p->level, p->num_pe);
         val_print(ACS_PRINT_TEST, "\n     ------------------------------------------------------------", 0);
         val_print(ACS_PRINT_TEST, "\n      Total Tests Run = %2d, ", g_acs_tests_total);
         val_print(ACS_PRINT_TEST, "Tests Passed = %2d, ", g_acs_tests_pass);
         val_print(ACS_PRINT_TEST, "Tests Failed = %2d ", g_acs_tests_fail);
         val_print(ACS_PRINT_TEST, "\n     ------------------------------------------------------------\n", 0);
-        params.arg0 = DRV_STATUS_AVAILABLE;
-        params.arg1 = val_get_status(0);
+        val_glue_result_end(SBSA_PCIE_EXECUTE_TEST);
+        pal_msg_set_active(false);
+        p->arg0 = DRV_STATUS_AVAILABLE;
+        p->arg1 = val_get_status(0);
     }
 
-    if(params.api_num == SBSA_UPDATE_SKIP_LIST){
-        g_skip_test_num = (unsigned int*) kmalloc(g_num_skip * sizeof(unsigned int), GFP_KERNEL);
-        g_skip_test_num[0] = params.arg0;
-        g_skip_test_num[1] = params.arg1;
-        g_skip_test_num[2] = params.arg2;
+    if(p->api_num == SBSA_UPDATE_SKIP_LIST){
+        bitmap_zero(s->skip, ACS_MAX_SEL_ID);
+        s->skip_dirty = true;
+        val_glue_skip_update(s, p->arg0, p->arg0, true);
+        val_glue_skip_update(s, p->arg1, p->arg1, true);
+        val_glue_skip_update(s, p->arg2, p->arg2, true);
+    }
+
+    if(p->api_num == SBSA_SKIP_ADD_RANGE)
+        val_glue_skip_update(s, p->arg0, p->arg1, true);
+
+    if(p->api_num == SBSA_SKIP_DEL_RANGE)
+        val_glue_skip_update(s, p->arg0, p->arg1, false);
+
+    if(p->api_num == SBSA_SKIP_CLEAR){
+        bitmap_zero(s->skip, ACS_MAX_SEL_ID);
+        s->skip_dirty = true;
     }
 
     return 0;
@@ -170,76 +693,684 @@ static
 ssize_t sbsa_proc_read(struct file *sp_file,char __user *buf, size_t size, loff_t *offset)
 {
 
-    int var;
-    var = copy_to_user(buf,&params,len);
+    size_t len;
+    test_params_t snap;
+    test_progress_t progress;
+    val_glue_session_t *s = &g_proc_session;
+
+    mutex_lock(&s->lock);
+    snap = s->params;
+    if (s->pending)
+        snap.arg0 = DRV_STATUS_PENDING;
+    val_glue_get_progress(s, &progress);
+    mutex_unlock(&s->lock);
+
+    len = min(size, sizeof(snap));
+    if (copy_to_user(buf, &snap, len))
+        return -EFAULT;
+
+    /* Readers asking for more than the params also get the progress */
+    if (size >= sizeof(snap) + sizeof(progress)) {
+        if (copy_to_user(buf + len, &progress, sizeof(progress)))
+            return -EFAULT;
+        return len + sizeof(progress);
+    }
+
     return len;
 }
 
 static
 ssize_t sbsa_proc_write(struct file *sp_file,const char __user *buf, size_t size, loff_t *offset)
 {
-    int var;
-    len = size;
-    var = copy_from_user(&params,buf,len);
-    val_glue_execute_command();
-    return len;
+    test_params_t params;
+    val_glue_session_t *s = &g_proc_session;
+
+    if (size != sizeof(params))
+        return -EINVAL;
+
+    if (copy_from_user(&params, buf, sizeof(params)))
+        return -EFAULT;
+
+    mutex_lock(&s->lock);
+    if (s->pending) {
+        mutex_unlock(&s->lock);
+        return -EBUSY;
+    }
+
+    s->params = params;
+
+    if (val_glue_is_execute(s->params.api_num)) {
+        s->params.arg0 = DRV_STATUS_PENDING;
+        val_glue_exec_begin(s, s->params.api_num);
+        queue_work(g_exec_wq, &s->work);
+        mutex_unlock(&s->lock);
+        return size;
+    }
+
+    val_glue_execute_locked(s, &s->params);
+    mutex_unlock(&s->lock);
+    return size;
 }
 
 static
-ssize_t sbsa_msg_proc_read(struct file *sp_file,char __user *buf, size_t size, loff_t *offset)
+__poll_t sbsa_proc_poll(struct file *sp_file, poll_table *wait)
 {
-    int length;
-    len = sizeof(test_msg_parms_t);
-    if(*offset == (tail_msg*len)) len=0;
+    poll_wait(sp_file, &g_exec_wait, wait);
 
-    length = simple_read_from_buffer(buf, len, offset, g_msg_buf, num_msg * sizeof(test_msg_parms_t));
+    if (READ_ONCE(g_proc_session.pending))
+        return 0;
 
-    if(length != 0)
-      memset(g_msg_buf+(*offset)-len, 0, sizeof(test_msg_parms_t));
+    return EPOLLIN | EPOLLRDNORM | EPOLLOUT | EPOLLWRNORM;
+}
 
-    return length;
+static
+int sbsa_cmd_open(struct inode *sp_inode, struct file *sp_file)
+{
+    val_glue_session_t *s;
+
+    s = kzalloc(sizeof(*s), GFP_KERNEL);
+    if (!s)
+        return -ENOMEM;
+
+    val_glue_session_init(s);
+    sp_file->private_data = s;
+    return 0;
+}
+
+static
+int sbsa_cmd_release(struct inode *sp_inode, struct file *sp_file)
+{
+    val_glue_session_t *s = sp_file->private_data;
+
+    val_glue_session_release(s);
+    kfree(s);
+    return 0;
+}
+
+/* Runs a batch of commands in order on the caller's thread, against the
+   session of this open file. Each command gets its arg0/arg1 back as a
+   write followed by a read of /proc/sbsa would return them; the batch stops
+   after the first command that fails. */
+static long
+sbsa_cmd_ioctl(struct file *sp_file, unsigned int cmd, unsigned long arg)
+{
+    val_glue_session_t *s = sp_file->private_data;
+    test_batch_t batch;
+    test_params_t *cmds;
+    test_params_t *p;
+    int status;
+    long ret = 0;
+
+    if (cmd != SBSA_IOC_SUBMIT)
+        return -ENOTTY;
+
+    if (copy_from_user(&batch, (void __user *)arg, sizeof(batch)))
+        return -EFAULT;
+
+    if (!batch.num_cmds || batch.num_cmds > SBSA_MAX_BATCH_CMDS)
+        return -EINVAL;
+
+    cmds = memdup_user((void __user *)batch.cmds, batch.num_cmds * sizeof(test_params_t));
+    if (IS_ERR(cmds))
+        return PTR_ERR(cmds);
+
+    mutex_lock(&s->lock);
+    if (s->pending) {
+        mutex_unlock(&s->lock);
+        kfree(cmds);
+        return -EBUSY;
+    }
+    val_glue_exec_begin(s, cmds[0].api_num);
+    mutex_unlock(&s->lock);
+
+    for (batch.num_done = 0; batch.num_done < batch.num_cmds; ) {
+        if (fatal_signal_pending(current)) {
+            ret = -EINTR;
+            break;
+        }
+
+        p = &cmds[batch.num_done++];
+        WRITE_ONCE(s->api_num, p->api_num);
+        status = val_glue_execute_locked(s, p);
+        if (status)
+            break;
+    }
+
+    val_glue_exec_end(s);
+
+    if (copy_to_user((void __user *)batch.cmds, cmds, batch.num_done * sizeof(test_params_t)) ||
+        copy_to_user((void __user *)arg, &batch, sizeof(batch)))
+        ret = -EFAULT;
+
+    kfree(cmds);
+    return ret;
+}
+
+static const struct file_operations sbsa_cmd_fops = {
+    .owner = THIS_MODULE,
+    .open = sbsa_cmd_open,
+    .release = sbsa_cmd_release,
+    .unlocked_ioctl = sbsa_cmd_ioctl,
+};
+
+static struct miscdevice sbsa_cmd_dev = {
+    .minor = MISC_DYNAMIC_MINOR,
+    .name  = "sbsa",
+    .fops  = &sbsa_cmd_fops,
+    .mode  = 0666,
+};
+
+/* A snapshot written to /proc/sbsa_snapshot, opened write only, is collected
+   across writes and loaded once the last table has arrived. Opening it for
+   reading takes a copy of the tables as they are at that point. */
+#define VAL_GLUE_SNAPSHOT_MAX  (16 * IOVIRT_INFO_TBL_SZ)
+
+typedef struct {
+    void                  *buf;
+    size_t                len;
+    size_t                size;
+    bool                  loaded;
+} val_glue_snapshot_t;
+
+/* Changes whenever VAL changes the size of a table entry */
+static unsigned int
+val_glue_snapshot_layout(void)
+{
+    const uint32_t sizes[] = {
+        sizeof(((PE_INFO_TABLE *)0)->pe_info[0]),
+        sizeof(((PCIE_INFO_TABLE *)0)->block[0]),
+        sizeof(((PERIPHERAL_INFO_TABLE *)0)->info[0]),
+        sizeof(IOVIRT_BLOCK),
+        sizeof(NODE_DATA_MAP),
+    };
+
+    return jhash2(sizes, ARRAY_SIZE(sizes), SBSA_SNAPSHOT_VERSION);
+}
+
+/* Called with g_exec_lock held */
+static bool
+val_glue_snapshot_has(unsigned int table)
+{
+    return test_bit(table, &g_tables_valid) && *g_tables_ptr[table];
+}
+
+/* Checks a complete header and returns the size of the whole snapshot,
+   0 if it cannot be loaded by this driver */
+static size_t
+val_glue_snapshot_check(test_snapshot_t *hdr)
+{
+    size_t total = sizeof(*hdr);
+    unsigned int i;
+
+    if (hdr->magic != SBSA_SNAPSHOT_MAGIC || hdr->version != SBSA_SNAPSHOT_VERSION ||
+        hdr->layout != val_glue_snapshot_layout() || hdr->num_tables != VAL_GLUE_TBL_NUM)
+        return 0;
+
+    for (i = 0; i < SBSA_SNAPSHOT_MAX_TABLES; i++) {
+        if (hdr->size[i] > VAL_GLUE_SNAPSHOT_MAX)
+            return 0;
+        if (hdr->size[i] && i >= VAL_GLUE_TBL_NUM)
+            return 0;
+        total += hdr->size[i];
+    }
+
+    return total <= VAL_GLUE_SNAPSHOT_MAX ? total : 0;
+}
+
+/* True when n entries of the trailing array of a table fit in size bytes */
+#define VAL_GLUE_TABLE_FITS(type, array, n, size) \
+    ((size) >= offsetof(type, array) && \
+     ((size) - offsetof(type, array)) / sizeof(((type *)0)->array[0]) >= (uint64_t)(n))
+
+/* The IORT blocks are variable sized and refer to each other by offset */
+static bool
+val_glue_snapshot_iovirt_ok(IOVIRT_INFO_TABLE *table, uint32_t size)
+{
+    uint8_t *end = (uint8_t *)table + size;
+    IOVIRT_BLOCK *block, *ref;
+    uint32_t i, j, k;
+
+    if (!VAL_GLUE_TABLE_FITS(IOVIRT_INFO_TABLE, blocks, 0, size))
+        return false;
+
+    block = &table->blocks[0];
+    for (i = 0; i < table->num_blocks; i++) {
+        if ((uint8_t *)block + offsetof(IOVIRT_BLOCK, data_map) > end ||
+            (uint8_t *)IOVIRT_NEXT_BLOCK(block) > end)
+            return false;
+        block = IOVIRT_NEXT_BLOCK(block);
+    }
+
+    /* ITS groups hold identifiers in their data maps, not references */
+    block = &table->blocks[0];
+    for (i = 0; i < table->num_blocks; i++, block = IOVIRT_NEXT_BLOCK(block)) {
+        if (block->type == IOVIRT_NODE_ITS_GROUP)
+            continue;
+        for (j = 0; j < block->num_data_map; j++) {
+            ref = &table->blocks[0];
+            for (k = 0; k < table->num_blocks; k++, ref = IOVIRT_NEXT_BLOCK(ref))
+                if ((uint8_t *)ref - (uint8_t *)table == block->data_map[j].map.output_ref)
+                    break;
+            if (k == table->num_blocks)
+                return false;
+        }
+    }
+
+    return true;
+}
+
+/* Checks the element counts a table carries against the size it arrived
+   with, so that VAL never walks past the end of it */
+static bool
+val_glue_snapshot_table_ok(unsigned int table, void *data, uint32_t size)
+{
+    PE_INFO_TABLE *pe = data;
+    PCIE_INFO_TABLE *pcie = data;
+    PERIPHERAL_INFO_TABLE *per = data;
+
+    switch (table) {
+    case VAL_GLUE_TBL_PE:
+        return VAL_GLUE_TABLE_FITS(PE_INFO_TABLE, pe_info, 0, size) &&
+               pe->header.num_of_pe && pe->header.num_of_pe <= num_possible_cpus() &&
+               VAL_GLUE_TABLE_FITS(PE_INFO_TABLE, pe_info, pe->header.num_of_pe, size);
+    case VAL_GLUE_TBL_PCIE:
+        return VAL_GLUE_TABLE_FITS(PCIE_INFO_TABLE, block, 0, size) &&
+               VAL_GLUE_TABLE_FITS(PCIE_INFO_TABLE, block, pcie->num_entries, size);
+    case VAL_GLUE_TBL_PER:
+        /* VAL walks the blocks up to the end of table marker */
+        return VAL_GLUE_TABLE_FITS(PERIPHERAL_INFO_TABLE, info, 0, size) &&
+               VAL_GLUE_TABLE_FITS(PERIPHERAL_INFO_TABLE, info, per->header.num_all + 1ULL, size) &&
+               per->info[per->header.num_all].type == 0xFF;
+    case VAL_GLUE_TBL_IOVIRT:
+        return val_glue_snapshot_iovirt_ok(data, size);
+    default:
+        return false;
+    }
+}
+
+/* Runs VAL's create call on a table loaded from a snapshot. The PAL keeps
+   the content, VAL points its state at the table and derives what it
+   builds on top of it, e.g. the PCIe BDF table. Called with g_exec_lock
+   held. */
+static uint32_t
+val_glue_snapshot_import(unsigned int table)
+{
+    uint32_t status = 0;
+
+    pal_info_table_import(*g_tables_ptr[table]);
+    switch (table) {
+    case VAL_GLUE_TBL_PE:
+        status = val_pe_create_info_table(g_pe_info_ptr);
+        if (!status)
+            val_glue_alloc_shared_mem();
+        break;
+    case VAL_GLUE_TBL_PCIE:
+        val_pcie_create_info_table(g_pcie_info_ptr);
+        break;
+    case VAL_GLUE_TBL_PER:
+        val_peripheral_create_info_table(g_per_info_ptr);
+        break;
+    case VAL_GLUE_TBL_IOVIRT:
+        val_iovirt_create_info_table(g_iovirt_info_ptr);
+        break;
+    }
+    pal_info_table_import(NULL);
+
+    return status;
+}
+
+/* Replaces the tables carried by the snapshot, hands them to VAL and marks
+   them built, so the next CREATE_INFO_TABLES only discovers the others.
+   Refused while a session holds the tables. */
+static int
+val_glue_snapshot_load(test_snapshot_t *hdr)
+{
+    uint64_t *tables[VAL_GLUE_TBL_NUM] = { NULL };
+    uint8_t *data = (uint8_t *)&hdr[1];
+    unsigned int i;
+    int ret = 0;
+
+    for (i = 0; i < VAL_GLUE_TBL_NUM; i++) {
+        if (!hdr->size[i])
+            continue;
+        tables[i] = kvmalloc(hdr->size[i], GFP_KERNEL);
+        if (!tables[i]) {
+            ret = -ENOMEM;
+            goto out;
+        }
+        memcpy(tables[i], data, hdr->size[i]);
+        data += hdr->size[i];
+
+        if (!val_glue_snapshot_table_ok(i, tables[i], hdr->size[i])) {
+            ret = -EINVAL;
+            goto out;
+        }
+    }
+
+    mutex_lock(&g_exec_lock);
+    if (g_tables_refs) {
+        mutex_unlock(&g_exec_lock);
+        ret = -EBUSY;
+        goto out;
+    }
+
+    for (i = 0; i < VAL_GLUE_TBL_NUM; i++) {
+        if (!tables[i])
+            continue;
+        kvfree(*g_tables_ptr[i]);
+        *g_tables_ptr[i] = tables[i];
+        g_tables_size[i] = hdr->size[i];
+        tables[i] = NULL;
+
+        if (val_glue_snapshot_import(i)) {
+            kvfree(*g_tables_ptr[i]);
+            *g_tables_ptr[i] = NULL;
+            g_tables_size[i] = 0;
+            clear_bit(i, &g_tables_valid);
+            ret = -EINVAL;
+            break;
+        }
+        set_bit(i, &g_tables_valid);
+    }
+    mutex_unlock(&g_exec_lock);
+
+out:
+    for (i = 0; i < VAL_GLUE_TBL_NUM; i++)
+        kvfree(tables[i]);
+    return ret;
+}
+
+static
+int sbsa_snapshot_open(struct inode *sp_inode, struct file *sp_file)
+{
+    val_glue_snapshot_t *snap;
+    test_snapshot_t *hdr;
+    uint8_t *data;
+    unsigned int i;
+
+    snap = kzalloc(sizeof(*snap), GFP_KERNEL);
+    if (!snap)
+        return -ENOMEM;
+
+    if (!(sp_file->f_mode & FMODE_READ)) {
+        sp_file->private_data = snap;
+        return 0;
+    }
+
+    mutex_lock(&g_exec_lock);
+    snap->len = sizeof(*hdr);
+    for (i = 0; i < VAL_GLUE_TBL_NUM; i++)
+        if (val_glue_snapshot_has(i))
+            snap->len += g_tables_size[i];
+
+    if (snap->len == sizeof(*hdr)) {
+        mutex_unlock(&g_exec_lock);
+        kfree(snap);
+        return -ENODATA;
+    }
+
+    snap->buf = kvzalloc(snap->len, GFP_KERNEL);
+    if (!snap->buf) {
+        mutex_unlock(&g_exec_lock);
+        kfree(snap);
+        return -ENOMEM;
+    }
+
+    hdr = snap->buf;
+    hdr->magic      = SBSA_SNAPSHOT_MAGIC;
+    hdr->version    = SBSA_SNAPSHOT_VERSION;
+    hdr->layout     = val_glue_snapshot_layout();
+    hdr->num_tables = VAL_GLUE_TBL_NUM;
+    data = (uint8_t *)&hdr[1];
+    for (i = 0; i < VAL_GLUE_TBL_NUM; i++) {
+        if (!val_glue_snapshot_has(i))
+            continue;
+        hdr->size[i] = g_tables_size[i];
+        memcpy(data, *g_tables_ptr[i], g_tables_size[i]);
+        data += g_tables_size[i];
+    }
+    mutex_unlock(&g_exec_lock);
+
+    snap->size = snap->len;
+    snap->loaded = true;
+    sp_file->private_data = snap;
+    return 0;
+}
+
+static
+int sbsa_snapshot_release(struct inode *sp_inode, struct file *sp_file)
+{
+    val_glue_snapshot_t *snap = sp_file->private_data;
+
+    kvfree(snap->buf);
+    kfree(snap);
+    return 0;
+}
+
+static
+ssize_t sbsa_snapshot_read(struct file *sp_file, char __user *buf, size_t size, loff_t *offset)
+{
+    val_glue_snapshot_t *snap = sp_file->private_data;
+
+    return simple_read_from_buffer(buf, size, offset, snap->buf, snap->len);
+}
+
+static
+ssize_t sbsa_snapshot_write(struct file *sp_file, const char __user *buf, size_t size, loff_t *offset)
+{
+    val_glue_snapshot_t *snap = sp_file->private_data;
+    size_t total;
+    void *grown;
+    int ret;
+
+    /* Snapshots are loaded from a single sequential stream */
+    if (snap->loaded || *offset != snap->len)
+        return -EINVAL;
+
+    if (size > VAL_GLUE_SNAPSHOT_MAX - snap->len)
+        return -EFBIG;
+
+    if (snap->len + size > snap->size) {
+        total = max(snap->len + size, 2 * snap->size);
+        grown = kvmalloc(total, GFP_KERNEL);
+        if (!grown)
+            return -ENOMEM;
+        if (snap->buf)
+            memcpy(grown, snap->buf, snap->len);
+        kvfree(snap->buf);
+        snap->buf = grown;
+        snap->size = total;
+    }
+
+    if (copy_from_user(snap->buf + snap->len, buf, size))
+        return -EFAULT;
+    snap->len += size;
+    *offset += size;
+
+    if (snap->len < sizeof(test_snapshot_t))
+        return size;
+
+    total = val_glue_snapshot_check(snap->buf);
+    if (!total || snap->len > total)
+        return -EINVAL;
+
+    if (snap->len == total) {
+        ret = val_glue_snapshot_load(snap->buf);
+        if (ret)
+            return ret;
+        snap->loaded = true;
+    }
+
+    return size;
+}
+
+static
+ssize_t sbsa_msg_proc_read(struct file *sp_file,char __user *buf, size_t size, loff_t *offset)
+{
+    return pal_msg_read(sp_file, buf, size);
+}
+
+static
+__poll_t sbsa_msg_proc_poll(struct file *sp_file, poll_table *wait)
+{
+    return pal_msg_poll(sp_file, wait);
+}
+
+static
+ssize_t sbsa_result_proc_read(struct file *sp_file,char __user *buf, size_t size, loff_t *offset)
+{
+    return pal_msg_result_read(buf, size);
 }
 
 #if LINUX_VERSION_CODE > KERNEL_VERSION(5,6,0)
+const struct proc_ops sbsa_result_fops = {
+    .proc_open = sbsa_proc_open,
+    .proc_read = sbsa_result_proc_read,
+    .proc_release = sbsa_proc_release
+};
+
 const struct proc_ops sbsa_msg_fops = {
     .proc_open = sbsa_proc_open,
     .proc_read = sbsa_msg_proc_read,
+    .proc_poll = sbsa_msg_proc_poll,
     .proc_release = sbsa_proc_release
 };
 
+static const struct proc_ops sbsa_snapshot_fops = {
+    .proc_open = sbsa_snapshot_open,
+    .proc_read = sbsa_snapshot_read,
+    .proc_write = sbsa_snapshot_write,
+    .proc_release = sbsa_snapshot_release
+};
+
 static const struct proc_ops fops = {
     .proc_open = sbsa_proc_open,
     .proc_read = sbsa_proc_read,
     .proc_write = sbsa_proc_write,
+    .proc_poll = sbsa_proc_poll,
     .proc_release = sbsa_proc_release
 };
 #else
+struct file_operations sbsa_result_fops = {
+    .open = sbsa_proc_open,
+    .read = sbsa_result_proc_read,
+    .release = sbsa_proc_release
+};
+
 struct file_operations sbsa_msg_fops = {
     .open = sbsa_proc_open,
     .read = sbsa_msg_proc_read,
+    .poll = sbsa_msg_proc_poll,
     .release = sbsa_proc_release
 };
 
+struct file_operations sbsa_snapshot_fops = {
+    .open = sbsa_snapshot_open,
+    .read = sbsa_snapshot_read,
+    .write = sbsa_snapshot_write,
+    .release = sbsa_snapshot_release
+};
+
 struct file_operations fops = {
     .open = sbsa_proc_open,
     .read = sbsa_proc_read,
     .write = sbsa_proc_write,
+    .poll = sbsa_proc_poll,
     .release = sbsa_proc_release
 };
 #endif
 
 static int __init init_sbsaproc (void)
 {
+    int ret;
+
     printk("init SBSA Driver \n");
+    if (pal_msg_init("sbsa_msg")) {
+        printk("ERROR! SBSA Msg device\n");
+        return -ENOMEM;
+    }
+    pal_print_set_level(g_print_level);
+    val_glue_session_init(&g_proc_session);
+
+    g_exec_wq = alloc_ordered_workqueue("sbsa_exec", 0);
+    if (!g_exec_wq) {
+        printk("ERROR! SBSA exec workqueue\n");
+        pal_msg_exit();
+        return -ENOMEM;
+    }
+
+    ret = bus_register_notifier(&pci_bus_type, &g_tables_pci_nb);
+    if (ret) {
+        printk("ERROR! SBSA PCI notifier\n");
+        destroy_workqueue(g_exec_wq);
+        pal_msg_exit();
+        return ret;
+    }
+
+    ret = cpuhp_setup_state_nocalls(CPUHP_AP_ONLINE_DYN, "sbsa_acs:online",
+                                    val_glue_cpu_notify, val_glue_cpu_notify);
+    if (ret < 0) {
+        printk("ERROR! SBSA CPU hotplug state\n");
+        bus_unregister_notifier(&pci_bus_type, &g_tables_pci_nb);
+        destroy_workqueue(g_exec_wq);
+        pal_msg_exit();
+        return ret;
+    }
+    g_tables_cpuhp = ret;
+
+    if (misc_register(&sbsa_cmd_dev)) {
+        printk("ERROR! SBSA command device\n");
+        cpuhp_remove_state_nocalls(g_tables_cpuhp);
+        bus_unregister_notifier(&pci_bus_type, &g_tables_pci_nb);
+        destroy_workqueue(g_exec_wq);
+        pal_msg_exit();
+        return -ENODEV;
+    }
+
     if (!proc_create("sbsa",0666,NULL,&fops)) {
         printk("ERROR! proc_create\n");
         remove_proc_entry("sbsa",NULL);
+        misc_deregister(&sbsa_cmd_dev);
+        cpuhp_remove_state_nocalls(g_tables_cpuhp);
+        bus_unregister_notifier(&pci_bus_type, &g_tables_pci_nb);
+        destroy_workqueue(g_exec_wq);
+        pal_msg_exit();
         return -1;
     }
 
     if (!proc_create("sbsa_msg",0666,NULL,&sbsa_msg_fops)) {
         printk("ERROR! proc_create SBSA Msg \n");
         remove_proc_entry("sbsa_msg",NULL);
+        misc_deregister(&sbsa_cmd_dev);
+        cpuhp_remove_state_nocalls(g_tables_cpuhp);
+        bus_unregister_notifier(&pci_bus_type, &g_tables_pci_nb);
+        destroy_workqueue(g_exec_wq);
+        pal_msg_exit();
+        return -1;
+    }
+
+    if (!proc_create("sbsa_result",0444,NULL,&sbsa_result_fops)) {
+        printk("ERROR! proc_create SBSA Result \n");
+        remove_proc_entry("sbsa_result",NULL);
+        misc_deregister(&sbsa_cmd_dev);
+        cpuhp_remove_state_nocalls(g_tables_cpuhp);
+        bus_unregister_notifier(&pci_bus_type, &g_tables_pci_nb);
+        destroy_workqueue(g_exec_wq);
+        pal_msg_exit();
+        return -1;
+    }
+
+    if (!proc_create("sbsa_snapshot",0600,NULL,&sbsa_snapshot_fops)) {
+        printk("ERROR! proc_create SBSA Snapshot \n");
+        remove_proc_entry("sbsa_snapshot",NULL);
+        remove_proc_entry("sbsa_result",NULL);
+        remove_proc_entry("sbsa_msg",NULL);
+        remove_proc_entry("sbsa",NULL);
+        misc_deregister(&sbsa_cmd_dev);
+        cpuhp_remove_state_nocalls(g_tables_cpuhp);
+        bus_unregister_notifier(&pci_bus_type, &g_tables_pci_nb);
+        destroy_workqueue(g_exec_wq);
+        pal_msg_exit();
         return -1;
     }
 
@@ -251,6 +1382,20 @@ void __exit exit_sbsaproc(void)
 {
     remove_proc_entry("sbsa",NULL);
     remove_proc_entry("sbsa_msg",NULL);
+    remove_proc_entry("sbsa_result",NULL);
+    remove_proc_entry("sbsa_snapshot",NULL);
+    misc_deregister(&sbsa_cmd_dev);
+    cpuhp_remove_state_nocalls(g_tables_cpuhp);
+    bus_unregister_notifier(&pci_bus_type, &g_tables_pci_nb);
+    destroy_workqueue(g_exec_wq);
+    val_glue_session_release(&g_proc_session);
+    val_glue_free_info_tables();
+    pal_pci_dev_cache_free();
+    pal_pcie_ecam_unmap();
+    kfree(g_sel_tests);
+    kfree(g_sel_modules);
+    pal_mmio_map_cache_free();
+    pal_msg_exit();
     printk("exit SBSA Driver \n");
 }
 
@@ -23,12 +23,16 @@
 #include <linux/kernel.h>
 #include <linux/proc_fs.h>
 #include <linux/uaccess.h>
+#include <linux/ioctl.h>
 
 #include <linux/slab.h>
 
 #define SBSA_CREATE_INFO_TABLES 0x1000
 #define SBSA_PCIE_EXECUTE_TEST  0x2000
 #define SBSA_UPDATE_SKIP_LIST   0x3000
+#define SBSA_SKIP_ADD_RANGE     0x3001   /* skip tests arg0..arg1 */
+#define SBSA_SKIP_DEL_RANGE     0x3002   /* stop skipping tests arg0..arg1 */
+#define SBSA_SKIP_CLEAR         0x3003
 #define SBSA_SMMU_EXECUTE_TEST  0x5000
 #define SBSA_FREE_INFO_TABLES   0x9000
 
@@ -36,7 +40,8 @@
 #define DRV_STATUS_AVAILABLE     0x10000000
 #define DRV_STATUS_PENDING       0x40000000
 
-/* Please MAKE SURE all table sizes are 16 bytes aligned */
+/* Please MAKE SURE all table sizes are 16 bytes aligned. Tables are sized
+   by the PAL, these are only used when it cannot tell the size up front */
 #define PE_INFO_TBL_SZ             16384    /* Supports maximum 400 PEs [40 B each + 4 B header] */
 #define IOVIRT_INFO_TBL_SZ         1048576  /* Supports maximum 2400 iort nodes [268+32*5 B each + 24 B header] */
 #define PERIPHERAL_INFO_TBL_SZ     8192     /* Supports maximum 145 PCIe peripheral device (anykind) [56 B each + 16 B header] */
@@ -54,7 +59,88 @@ struct __TEST_PARAMS__
     unsigned long arg2;
 }test_params_t;
 
+/* Returned after test_params_t by a read of the proc entry asking for more
+   than the params, so the progress of an execute command can be watched */
+typedef
+struct __TEST_PROGRESS__
+{
+    unsigned int  api_num;
+    unsigned int  status;       /* DRV_STATUS_PENDING while the command runs */
+    unsigned int  curr_module;
+    unsigned int  tests_run;    /* counted from the start of the command */
+    unsigned int  tests_pass;
+    unsigned int  tests_fail;
+    unsigned long elapsed_ns;
+}test_progress_t;
+
+/* Batch of commands submitted with SBSA_IOC_SUBMIT on /dev/sbsa. cmds points
+   to num_cmds test_params_t, each updated in place with its arg0/arg1;
+   num_done returns how many of them were run. */
+#define SBSA_MAX_BATCH_CMDS    64
+
+typedef
+struct __TEST_BATCH__
+{
+    unsigned int  num_cmds;
+    unsigned int  num_done;
+    unsigned long cmds;
+}test_batch_t;
+
+#define SBSA_IOC_MAGIC         'A'
+#define SBSA_IOC_SUBMIT        _IOWR(SBSA_IOC_MAGIC, 1, test_batch_t)
+
+/* Snapshot of the info tables, read from /proc/sbsa_snapshot once they are
+   created and written back to it to skip discovery on a later run. The
+   header is followed by the tables back to back in table id order. layout
+   identifies the VAL table layout so a snapshot is only loaded by a driver
+   built against the same VAL. */
+#define SBSA_SNAPSHOT_MAGIC      0x504e5353   /* "SSNP" */
+#define SBSA_SNAPSHOT_VERSION    1
+#define SBSA_SNAPSHOT_MAX_TABLES 8
+#define SBSA_SNAPSHOT_PE         0
+#define SBSA_SNAPSHOT_PCIE       1
+#define SBSA_SNAPSHOT_PER        2
+#define SBSA_SNAPSHOT_IOVIRT     3
+
+typedef
+struct __TEST_SNAPSHOT__
+{
+    unsigned int  magic;
+    unsigned int  version;
+    unsigned int  layout;
+    unsigned int  num_tables;
+    unsigned int  size[SBSA_SNAPSHOT_MAX_TABLES];   /* bytes, 0 for a table left out */
+}test_snapshot_t;
+
 typedef struct __TEST_SBSA_MSG__ {
     char string[92];
     unsigned long data;
 }test_msg_parms_t;
+
+/* Releases the MMIO mappings cached by the PAL accessors */
+void pal_mmio_map_cache_free(void);
+
+/* Keeps the PAL BDF to pci_dev cache in step with PCI hotplug */
+struct pci_dev;
+void pal_pci_dev_cache_add(struct pci_dev *pdev);
+void pal_pci_dev_cache_del(struct pci_dev *pdev);
+void pal_pci_dev_cache_free(void);
+
+/* Drops the config space snapshot of a function, e.g. after it was reset */
+void pal_pci_cfg_cache_invalidate(uint32_t bdf);
+unsigned int pal_pcie_get_bdf(struct pci_dev *dev);
+
+/* Makes the next create call on a table keep what a snapshot loaded */
+void pal_info_table_import(void *table);
+
+/* Unmaps the ECAM windows of the direct_ecam config read path */
+void pal_pcie_ecam_unmap(void);
+
+/* Sizes of the info tables as found by the PAL, 0 when not known up front */
+uint32_t pal_pe_info_table_size(void);
+uint32_t pal_pcie_info_table_size(void);
+uint32_t pal_peripheral_info_table_size(void);
+uint32_t pal_iovirt_info_table_size(void);
+
+/* Applies a new print level to the acs_print static keys */
+void pal_print_set_level(uint32_t level);
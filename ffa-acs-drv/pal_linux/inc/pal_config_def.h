@@ -68,6 +68,13 @@
 /* SMMU stream id */
 #define PLATFORM_SMMU_STREAM_ID   1
 
+/* Number of SMMU test engine frames kept in flight by a single transfer.
+ * 1 programs and completes one 4K frame at a time.
+ */
+#ifndef PLATFORM_SMMU_TE_FRAME_WINDOW
+#define PLATFORM_SMMU_TE_FRAME_WINDOW   16
+#endif
+
 /*
  * Retrieving of memory region by specifying address ranges.
  * this is about retrieving memory without handle value and
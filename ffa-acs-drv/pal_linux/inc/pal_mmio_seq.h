@@ -0,0 +1,64 @@
+/*
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2024 Arm Limited
+ *
+ */
+
+#ifndef _PAL_MMIO_SEQ_H_
+#define _PAL_MMIO_SEQ_H_
+
+#include "pal_interfaces.h"
+
+/* A window is a device region mapped once and then accessed by offset,
+ * so that programming a block of registers does not remap per access.
+ */
+typedef struct {
+    void __iomem *base;
+    uint64_t pa;
+    uint64_t size;
+} pal_mmio_window_t;
+
+/* One register write of a sequence, width is in bytes (4 or 8) */
+typedef struct {
+    uint32_t offset;
+    uint32_t width;
+    uint64_t value;
+} pal_mmio_reg_seq_t;
+
+#define PAL_MMIO_REG32(off, val)  { .offset = (off), .width = 4, .value = (val) }
+#define PAL_MMIO_REG64(off, val)  { .offset = (off), .width = 8, .value = (val) }
+
+/* Maps size bytes of device memory at pa into the window */
+uint32_t pal_mmio_window_map(pal_mmio_window_t *win, uint64_t pa, uint64_t size);
+
+/* Releases the mapping held by the window */
+void pal_mmio_window_unmap(pal_mmio_window_t *win);
+
+/* Orders all prior memory and MMIO writes before later MMIO writes */
+void pal_mmio_barrier(void);
+
+/* Applies count register writes at base + seq[n].offset. Every write is
+ * relaxed and no barrier is issued; the caller orders the sequence, e.g.
+ * sets up many frames before a single pal_mmio_barrier() and the kick.
+ */
+void pal_mmio_window_write_seq_relaxed(pal_mmio_window_t *win, uint64_t base,
+                                       const pal_mmio_reg_seq_t *seq, uint32_t count);
+
+void pal_mmio_window_write32_relaxed(pal_mmio_window_t *win, uint64_t offset, uint32_t data);
+void pal_mmio_window_write64_relaxed(pal_mmio_window_t *win, uint64_t offset, uint64_t data);
+
+uint32_t pal_mmio_window_read32(pal_mmio_window_t *win, uint64_t offset);
+
+#endif /* _PAL_MMIO_SEQ_H_ */
@@ -0,0 +1,48 @@
+/*
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2024 Arm Limited
+ *
+ */
+
+#ifndef _PAL_POLL_H_
+#define _PAL_POLL_H_
+
+#include "pal_interfaces.h"
+
+/* Time spent busy polling before the poller starts to back off */
+#define PAL_POLL_SPIN_US        10
+/* Backoff sleep bounds, the sleep doubles on every unsuccessful poll */
+#define PAL_POLL_SLEEP_MIN_US   10
+#define PAL_POLL_SLEEP_MAX_US   1000
+
+/* Returns true once the awaited device state is reached */
+typedef bool (*pal_poll_cond_t)(void *ctx);
+
+typedef struct {
+    uint64_t calls;
+    uint64_t polls;
+    uint64_t max_polls;
+    uint64_t timeouts;
+} pal_poll_stats_t;
+
+/* Polls cond until it holds or timeout_us of wall clock time elapsed.
+ * Returns PAL_SUCCESS, or PAL_ERROR on timeout.
+ */
+uint32_t pal_poll_until(pal_poll_cond_t cond, void *ctx, uint64_t timeout_us);
+
+/* Copies the statistics accumulated by pal_poll_until */
+void pal_poll_get_stats(pal_poll_stats_t *stats);
+
+#endif /* _PAL_POLL_H_ */
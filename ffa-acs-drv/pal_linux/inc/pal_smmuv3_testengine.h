@@ -69,6 +69,8 @@
 #define U_FRAME_BASE 0x2bfe0000
 /* Each frame is 128 bytes long */
 #define FRAME_SIZE 0x80
+/* Size of each of the user and privileged pages */
+#define FRAME_PAGE_SIZE 0x10000
 
 /* Privileged frame fields */
 #define PCTRL 0x0
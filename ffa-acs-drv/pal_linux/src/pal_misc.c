@@ -22,7 +22,14 @@
 #include <linux/slab.h>
 #include <asm/io.h>
 #include <linux/dma-mapping.h>
+#include <linux/delay.h>
+#include <linux/ktime.h>
+#include <linux/spinlock.h>
 #include "pal_interfaces.h"
+#include "pal_poll.h"
+
+static pal_poll_stats_t g_poll_stats;
+static DEFINE_SPINLOCK(g_poll_stats_lock);
 
 /* Note - This is unused for linux target */
 uint32_t pal_get_endpoint_device_map(void **region_list, size_t *no_of_mem_regions)
@@ -82,3 +89,73 @@ void *pal_memcpy(void *dst, const void *src, size_t len)
 {
   return memcpy(dst, src, len);
 }
+
+static void pal_poll_account(uint64_t polls, bool timed_out)
+{
+    unsigned long flags;
+
+    spin_lock_irqsave(&g_poll_stats_lock, flags);
+    g_poll_stats.calls++;
+    g_poll_stats.polls += polls;
+    if (polls > g_poll_stats.max_polls)
+        g_poll_stats.max_polls = polls;
+    if (timed_out)
+        g_poll_stats.timeouts++;
+    spin_unlock_irqrestore(&g_poll_stats_lock, flags);
+}
+
+uint32_t pal_poll_until(pal_poll_cond_t cond, void *ctx, uint64_t timeout_us)
+{
+    ktime_t start = ktime_get();
+    ktime_t spin_end = ktime_add_us(start, PAL_POLL_SPIN_US);
+    ktime_t deadline = ktime_add_us(start, timeout_us);
+    uint64_t sleep_us = PAL_POLL_SLEEP_MIN_US;
+    bool can_sleep = !(in_interrupt() || irqs_disabled());
+    uint64_t polls = 0;
+
+    for (;;)
+    {
+        polls++;
+        if (cond(ctx))
+        {
+            pal_poll_account(polls, false);
+            return PAL_SUCCESS;
+        }
+
+        if (ktime_after(ktime_get(), deadline))
+            break;
+
+        if (ktime_before(ktime_get(), spin_end))
+        {
+            cpu_relax();
+            continue;
+        }
+
+        if (can_sleep)
+            usleep_range(sleep_us, sleep_us * 2);
+        else
+            udelay(sleep_us);
+
+        sleep_us = min_t(uint64_t, sleep_us * 2, PAL_POLL_SLEEP_MAX_US);
+    }
+
+    /* The condition may have been met while the last backoff expired */
+    polls++;
+    if (cond(ctx))
+    {
+        pal_poll_account(polls, false);
+        return PAL_SUCCESS;
+    }
+
+    pal_poll_account(polls, true);
+    return PAL_ERROR;
+}
+
+void pal_poll_get_stats(pal_poll_stats_t *stats)
+{
+    unsigned long flags;
+
+    spin_lock_irqsave(&g_poll_stats_lock, flags);
+    *stats = g_poll_stats;
+    spin_unlock_irqrestore(&g_poll_stats_lock, flags);
+}
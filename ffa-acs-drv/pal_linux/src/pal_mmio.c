@@ -24,6 +24,7 @@
 #include <linux/dma-mapping.h>
 #include "pal_interfaces.h"
 #include "pal_mmio.h"
+#include "pal_mmio_seq.h"
 
 /* MMIO read/write access functions */
 /**
@@ -190,3 +191,120 @@ void pal_mmio_write32(uint64_t addr, uint32_t data)
 
   iounmap(p);
 }
+
+/**
+  @brief  Maps a device memory region once so that a block of its registers
+          can be accessed by offset without remapping per access
+
+  @param  win   window to initialise
+  @param  pa    64-bit physical address of the region
+  @param  size  size of the region in bytes
+
+  @return PAL_SUCCESS or PAL_ERROR if the region could not be mapped
+**/
+uint32_t pal_mmio_window_map(pal_mmio_window_t *win, uint64_t pa, uint64_t size)
+{
+  win->base = ioremap(pa, size);
+  if (!win->base)
+      return PAL_ERROR;
+
+  win->pa = pa;
+  win->size = size;
+
+  return PAL_SUCCESS;
+}
+
+/**
+  @brief  Releases the mapping held by a window
+
+  @param  win  window returned by pal_mmio_window_map
+
+  @return None
+**/
+void pal_mmio_window_unmap(pal_mmio_window_t *win)
+{
+  if (win->base)
+      iounmap(win->base);
+
+  win->base = NULL;
+  win->size = 0;
+}
+
+/**
+  @brief  Orders all prior memory and MMIO writes before any MMIO write
+          issued after it. Used to close a run of relaxed accesses.
+
+  @return None
+**/
+void pal_mmio_barrier(void)
+{
+  wmb();
+}
+
+/**
+  @brief  Applies a sequence of register writes against a mapped window
+          with relaxed accessors and no barrier. The caller orders the
+          sequence with pal_mmio_barrier() where needed.
+
+  @param  win    mapped window
+  @param  base   offset within the window the sequence offsets are relative to
+  @param  seq    register writes in program order
+  @param  count  number of entries in seq
+
+  @return None
+**/
+void pal_mmio_window_write_seq_relaxed(pal_mmio_window_t *win, uint64_t base,
+                                       const pal_mmio_reg_seq_t *seq, uint32_t count)
+{
+  uint32_t i;
+
+  for (i = 0; i < count; i++) {
+      if (seq[i].width == 8)
+          pal_mmio_window_write64_relaxed(win, base + seq[i].offset, seq[i].value);
+      else
+          pal_mmio_window_write32_relaxed(win, base + seq[i].offset, (uint32_t)seq[i].value);
+  }
+}
+
+/**
+  @brief  Writes 32-bit data at an offset of a mapped window without
+          ordering it against prior memory accesses
+
+  @param  win     mapped window
+  @param  offset  offset within the window
+  @param  data    32-bit data to write
+
+  @return None
+**/
+void pal_mmio_window_write32_relaxed(pal_mmio_window_t *win, uint64_t offset, uint32_t data)
+{
+  writel_relaxed(data, win->base + offset);
+}
+
+/**
+  @brief  Writes 64-bit data at an offset of a mapped window without
+          ordering it against prior memory accesses
+
+  @param  win     mapped window
+  @param  offset  offset within the window
+  @param  data    64-bit data to write
+
+  @return None
+**/
+void pal_mmio_window_write64_relaxed(pal_mmio_window_t *win, uint64_t offset, uint64_t data)
+{
+  writeq_relaxed(data, win->base + offset);
+}
+
+/**
+  @brief  Reads 32-bit data at an offset of a mapped window
+
+  @param  win     mapped window
+  @param  offset  offset within the window
+
+  @return 32-bit data read from the window
+**/
+uint32_t pal_mmio_window_read32(pal_mmio_window_t *win, uint64_t offset)
+{
+  return readl(win->base + offset);
+}
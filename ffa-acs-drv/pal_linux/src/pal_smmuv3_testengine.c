@@ -23,84 +23,166 @@
 #include <asm/io.h>
 
 #include "pal_interfaces.h"
+#include "pal_config_def.h"
 #include "pal_smmuv3_testengine.h"
+#include "pal_mmio_seq.h"
+#include "pal_poll.h"
 
 #define PAGE_SIZE_4K        0x1000
 #define F_IDX(n)            (n * FRAME_SIZE)
-#define TIME_OUT            0x100000
+/* Wall clock time a single frame is given to complete its copy */
+#define TIME_OUT_US         1000000
+
+/* Programs frame i to copy one 4K page, without starting the engine */
+static void smmuv3_testengine_program_frame(pal_mmio_window_t *p_frame,
+                                            pal_mmio_window_t *u_frame, uint32_t i,
+                                            uint32_t stream_id, uint32_t ssd_ns,
+                                            uint64_t source, uint64_t dest)
+{
+    uint64_t begin = source + (i * PAGE_SIZE_4K);
+    uint64_t end_ctrl = begin + (PAGE_SIZE_4K - 1);
+    uint64_t o_buf = dest + (i * PAGE_SIZE_4K);
+
+    /* Initialize the Privileged frame */
+    const pal_mmio_reg_seq_t p_seq[] = {
+        PAL_MMIO_REG32(PCTRL, ssd_ns),
+        PAL_MMIO_REG32(DOWNSTREAM_PORT_INDEX, 0),
+        PAL_MMIO_REG32(STREAM_ID, stream_id),
+        PAL_MMIO_REG32(SUBSTREAM_ID, NO_SUBSTREAMID),
+    };
+
+    /* Initialize the user frame */
+    const pal_mmio_reg_seq_t u_seq[] = {
+        PAL_MMIO_REG32(UCTRL, 0),
+        PAL_MMIO_REG32(SEED, 0),
+        PAL_MMIO_REG64(BEGIN, begin),
+        PAL_MMIO_REG64(END_CTRL, end_ctrl),
+        PAL_MMIO_REG32(STRIDE, 0x1),
+        PAL_MMIO_REG64(UDATA, o_buf),
+    };
+
+    pal_mmio_window_write_seq_relaxed(p_frame, F_IDX(i), p_seq, ARRAY_SIZE(p_seq));
+    pal_mmio_window_write_seq_relaxed(u_frame, F_IDX(i), u_seq, ARRAY_SIZE(u_seq));
+}
+
+struct smmuv3_testengine_frame {
+    pal_mmio_window_t *u_frame;
+    uint32_t index;
+    uint32_t cmd;
+};
+
+static bool smmuv3_testengine_frame_done(void *ctx)
+{
+    struct smmuv3_testengine_frame *frame = ctx;
+
+    frame->cmd = pal_mmio_window_read32(frame->u_frame, CMD + F_IDX(frame->index));
+
+    return (frame->cmd != ENGINE_MEMCPY);
+}
+
+/* Waits for the copy started on frame i to complete */
+static uint32_t smmuv3_testengine_reap_frame(pal_mmio_window_t *u_frame, uint32_t i)
+{
+    struct smmuv3_testengine_frame frame = { .u_frame = u_frame, .index = i };
+    pal_poll_stats_t stats;
+
+    if (pal_poll_until(smmuv3_testengine_frame_done, &frame, TIME_OUT_US))
+    {
+        pal_poll_get_stats(&stats);
+        pal_printf("ERROR: SMMU test engine timeout, %llu timeouts in %llu waits\n",
+                   stats.timeouts, stats.calls);
+        return PAL_ERROR;
+    }
+
+    if (frame.cmd != ENGINE_HALTED)
+    {
+        pal_printf("ERROR: SMMU data transfer failed\n", 0, 0);
+        return PAL_ERROR;
+    }
+
+    return PAL_SUCCESS;
+}
 
 uint32_t smmuv3_configure_testengine(uint32_t stream_id, uint64_t source, uint64_t dest,
                                      uint64_t size, bool secure)
 {
     uint32_t num_frames = (uint32_t)size/PAGE_SIZE_4K;
-    uint64_t begin = 0;
-    uint64_t end_ctrl;
-    uint64_t o_buf;
+    uint32_t window = PLATFORM_SMMU_TE_FRAME_WINDOW;
     uint32_t ssd_ns;
-    uint32_t data;
-    uint64_t time_out = TIME_OUT;
-    uint32_t i;
+    uint32_t status = PAL_SUCCESS;
+    pal_mmio_window_t p_frame, u_frame;
+    uint32_t first, last, i;
 
     /* TODO Add assert condtion for source and destination address */
     if (num_frames < 1)
         return PAL_ERROR;
 
+    if (num_frames > FRAME_PAGE_SIZE / FRAME_SIZE)
+    {
+        pal_printf("ERROR: SMMU test engine has no frame for size %llx\n", size, 0);
+        return PAL_ERROR;
+    }
+
+    if (window < 1)
+        window = 1;
+
     if (secure)
         ssd_ns = 0;
     else
         ssd_ns = 1;
 
-    for (i = 0; i < num_frames; i++)
+    /* Map the privileged and user pages once for the whole transfer */
+    if (pal_mmio_window_map(&p_frame, P_FRAME_BASE, FRAME_PAGE_SIZE))
+        return PAL_ERROR;
+
+    if (pal_mmio_window_map(&u_frame, U_FRAME_BASE, FRAME_PAGE_SIZE))
     {
-        begin = source + (i * PAGE_SIZE_4K);
-        end_ctrl = begin + (PAGE_SIZE_4K - 1);
-        o_buf = dest + (i * PAGE_SIZE_4K);
-        /* Initialize the Privileged frame */
-        pal_mmio_write32((P_FRAME_BASE + PCTRL + F_IDX(i)), ssd_ns);
-        pal_mmio_write32((P_FRAME_BASE + DOWNSTREAM_PORT_INDEX + F_IDX(i)), 0);
-        pal_mmio_write32((P_FRAME_BASE + STREAM_ID + F_IDX(i)), stream_id);
-        pal_mmio_write32((P_FRAME_BASE + SUBSTREAM_ID + F_IDX(i)), NO_SUBSTREAMID);
-
-        /* Initialize the user frame */
-        pal_mmio_write32((U_FRAME_BASE + UCTRL + F_IDX(i)), 0);
-        pal_mmio_write32((U_FRAME_BASE + SEED + F_IDX(i)), 0);
-        pal_mmio_write64((U_FRAME_BASE + BEGIN + F_IDX(i)), begin);
-        pal_mmio_write64((U_FRAME_BASE + END_CTRL + F_IDX(i)), end_ctrl);
-        pal_mmio_write32((U_FRAME_BASE + STRIDE + F_IDX(i)), 0x1);
-        pal_mmio_write64((U_FRAME_BASE + UDATA + F_IDX(i)), o_buf);
-        pal_mmio_write32((U_FRAME_BASE + CMD + F_IDX(i)), ENGINE_MEMCPY);
-
-        while (--time_out)
-        {
-            data = pal_mmio_read32((U_FRAME_BASE + CMD + F_IDX(i)));
-
-            if (data == ENGINE_MEMCPY)
-                continue;
-
-            if (data != ENGINE_HALTED)
-            {
-                pal_printf("ERROR: SMMU data transfer failed\n", 0, 0);
-                return PAL_ERROR;
-            }
-            else
-                break;
-        }
+        pal_mmio_window_unmap(&p_frame);
+        return PAL_ERROR;
+    }
+
+    /* Each 4K page is copied by its own frame. Up to window frames are
+     * programmed, started back to back and then reaped, so that the engine
+     * works on them in parallel.
+     */
+    for (first = 0; first < num_frames; first += window)
+    {
+        last = min(first + window, num_frames);
+
+        for (i = first; i < last; i++)
+            smmuv3_testengine_program_frame(&p_frame, &u_frame, i, stream_id,
+                                            ssd_ns, source, dest);
+
+        /* One barrier orders the frame set up and the buffers before the
+         * engine is started on any of them.
+         */
+        pal_mmio_barrier();
 
-        if (!time_out)
+        for (i = first; i < last; i++)
+            pal_mmio_window_write32_relaxed(&u_frame, CMD + F_IDX(i), ENGINE_MEMCPY);
+
+        /* Reap every started frame even after a failure, so that none is
+         * still copying once this returns.
+         */
+        for (i = first; i < last; i++)
         {
-            pal_printf("ERROR: SMMU test engine timeout\n", 0, 0);
-            return PAL_ERROR;
+            if (smmuv3_testengine_reap_frame(&u_frame, i))
+                status = PAL_ERROR;
         }
 
-        time_out = TIME_OUT;
+        if (status)
+            goto unmap;
     }
 
-
-    if (pal_memcmp((void *)begin, (void *)dest, size))
+    if (pal_memcmp((void *)source, (void *)dest, size))
     {
         pal_printf("ERROR: SMMU: Data mismatched\n", 0, 0);
-        return PAL_ERROR;
+        status = PAL_ERROR;
     }
 
-    return PAL_SUCCESS;
+unmap:
+    pal_mmio_window_unmap(&u_frame);
+    pal_mmio_window_unmap(&p_frame);
+
+    return status;
 }
@@ -223,6 +223,7 @@ static ssize_t sdei_msg_proc_write(struct file *sp_file,const char __user *buf,
 		val_watchdog_free_info_table();
 		val_timer_free_info_table();
 		kfree(g_msg_buf);
+		pal_mmio_map_cache_free();
 	}
 	return sizeof(flag);
 }
@@ -280,6 +281,7 @@ static void __exit exit_sdeiproc(void)
 {
 	remove_proc_entry("sdei",NULL);
 	remove_proc_entry("sdei_msg",NULL);
+	pal_mmio_map_cache_free();
 }
 
 MODULE_INFO(intree, "Y");
@@ -41,4 +41,6 @@ typedef struct __SDEI_MSG__ {
     char string[100];
     unsigned long data;
 }test_msg_parms_t;
+
+void pal_mmio_map_cache_free(void);
 #endif
@@ -32,8 +32,29 @@ uint64_t pal_get_mcfg_ptr(void);
 
 uint64_t pal_get_madt_ptr(void);
 
+void pal_mmio_write_relaxed(uint64_t addr, uint32_t data);
+
+void pal_mmio_barrier(void);
+
+void pal_va_write_relaxed(uint64_t *addr, uint32_t offset, uint32_t data);
+
 #define NUM_MSG_GROW(n) n*2
 extern sdei_log_control g_log_control;
+
+/* Prints less important than ACS_LOG_FLOOR are compiled out of the PAL.
+ * Within the PAL the print level is checked inline, so that a disabled
+ * print does not pay for the varargs call. VAL calls the function directly.
+ */
+#ifndef ACS_LOG_FLOOR
+#define ACS_LOG_FLOOR ACS_LOG_KERNEL
+#endif
+
+#define pal_print(verbosity, ...) \
+	do { \
+		if ((verbosity) <= ACS_LOG_FLOOR && \
+		    (verbosity) <= g_log_control.print_level) \
+			(pal_print)(verbosity, __VA_ARGS__); \
+	} while (0)
 extern char *g_msg_buf;
 extern int g_tail_msg;
 
@@ -20,6 +20,9 @@
 #include <linux/slab.h>
 #include <linux/kernel.h>
 #include <linux/device.h>
+#include <linux/radix-tree.h>
+#include <linux/rcupdate.h>
+#include <linux/spinlock.h>
 #include <asm/io.h>
 #include "pal_linux.h"
 #include "pal_interface.h"
@@ -27,6 +30,108 @@
 pe_shared_mem_t *g_pe_shared_mem;
 extern int g_num_msg;
 
+/* Page sized MMIO mappings, kept until the test cleanup so that the
+ * timer and watchdog register accesses do not ioremap on every access.
+ */
+typedef struct {
+	struct list_head node;
+	unsigned long pfn;
+	void __iomem *va;
+} pal_mmio_map_t;
+
+static RADIX_TREE(g_mmio_map_tree, GFP_ATOMIC);
+static LIST_HEAD(g_mmio_map_list);
+static DEFINE_SPINLOCK(g_mmio_map_lock);
+
+/**
+ *  @brief This API returns the cached mapping of a MMIO address, creating
+ *		   it on the first access to the page
+ *
+ *  @param  addr 64-bit address
+ *
+ *  @return Virtual address, or NULL if the access has to use a transient
+ *		    mapping
+ */
+static void __iomem *pal_mmio_map_cache_get(uint64_t addr)
+{
+	unsigned long pfn = addr >> PAGE_SHIFT;
+	pal_mmio_map_t *entry, *new_entry;
+	void __iomem *va = NULL;
+	unsigned long flags;
+
+	/* The entry may be freed once the read side section ends, so only the
+	 * mapping is taken out of it
+	 */
+	rcu_read_lock();
+	entry = radix_tree_lookup(&g_mmio_map_tree, pfn);
+	if (entry)
+		va = entry->va + offset_in_page(addr);
+	rcu_read_unlock();
+	if (va)
+		return va;
+
+	/* SDEI handlers and ISRs cannot sleep to create the mapping */
+	if (in_interrupt() || irqs_disabled())
+		return NULL;
+
+	new_entry = kmalloc(sizeof(*new_entry), GFP_KERNEL);
+	if (!new_entry)
+		return NULL;
+
+	new_entry->pfn = pfn;
+	new_entry->va = ioremap((phys_addr_t)pfn << PAGE_SHIFT, PAGE_SIZE);
+	if (!new_entry->va || radix_tree_preload(GFP_KERNEL)) {
+		if (new_entry->va)
+			iounmap(new_entry->va);
+		kfree(new_entry);
+		return NULL;
+	}
+
+	spin_lock_irqsave(&g_mmio_map_lock, flags);
+	entry = radix_tree_lookup(&g_mmio_map_tree, pfn);
+	if (!entry) {
+		radix_tree_insert(&g_mmio_map_tree, pfn, new_entry);
+		list_add(&new_entry->node, &g_mmio_map_list);
+		entry = new_entry;
+		new_entry = NULL;
+	}
+	va = entry->va + offset_in_page(addr);
+	spin_unlock_irqrestore(&g_mmio_map_lock, flags);
+	radix_tree_preload_end();
+
+	if (new_entry) {
+		iounmap(new_entry->va);
+		kfree(new_entry);
+	}
+
+	return va;
+}
+
+/**
+ *  @brief This API releases all the cached MMIO mappings
+ *
+ *  @return None
+ */
+void pal_mmio_map_cache_free(void)
+{
+	pal_mmio_map_t *entry, *tmp;
+	unsigned long flags;
+	LIST_HEAD(free_list);
+
+	spin_lock_irqsave(&g_mmio_map_lock, flags);
+	list_for_each_entry(entry, &g_mmio_map_list, node)
+		radix_tree_delete(&g_mmio_map_tree, entry->pfn);
+	list_splice_init(&g_mmio_map_list, &free_list);
+	spin_unlock_irqrestore(&g_mmio_map_lock, flags);
+
+	synchronize_rcu();
+
+	list_for_each_entry_safe(entry, tmp, &free_list, node) {
+		iounmap(entry->va);
+		kfree(entry);
+	}
+}
+
 /**
  *  @brief This API provides a single point of abstraction to read from all
  *		   Memory Mapped IO address
@@ -38,13 +143,18 @@ extern int g_num_msg;
 uint32_t pal_mmio_read(uint64_t addr)
 {
 	uint32_t data;
-	uint64_t *p;
+	void __iomem *p;
 
 	if (addr & 0x3) {
 		pal_print(ACS_LOG_WARN, "\n        Error-Input address is not aligned.");
 		/* make sure addr is aligned to 4 bytes */
 		addr = addr & ~(0x3);
 	}
+
+	p = pal_mmio_map_cache_get(addr);
+	if (p)
+		return ioread32(p);
+
 	p = ioremap(addr, 16);
 	data = ioread32(p);
 	iounmap(p);
@@ -63,13 +173,55 @@ uint32_t pal_mmio_read(uint64_t addr)
  */
 void pal_mmio_write(uint64_t addr, uint32_t data)
 {
-	uint64_t *p;
+	void __iomem *p;
+
+	p = pal_mmio_map_cache_get(addr);
+	if (p) {
+		iowrite32(data, p);
+		return;
+	}
+
 	p = ioremap(addr, 16);
 	iowrite32(data, p);
+	iounmap(p);
+}
+
+/**
+ * @brief This API writes to a Memory Mapped IO address without ordering
+ *		  the write against prior memory accesses. A sequence of relaxed
+ *		  writes is ordered as a whole with pal_mmio_barrier().
+ *
+ * @param  addr  64-bit address
+ * @param  data  32-bit data to write to address
+ *
+ * @return None
+ */
+void pal_mmio_write_relaxed(uint64_t addr, uint32_t data)
+{
+	void __iomem *p;
+
+	p = pal_mmio_map_cache_get(addr);
+	if (p) {
+		writel_relaxed(data, p);
+		return;
+	}
 
+	p = ioremap(addr, 16);
+	writel_relaxed(data, p);
 	iounmap(p);
 }
 
+/**
+ * @brief This API orders all prior memory and MMIO writes before the MMIO
+ *		  writes that follow it
+ *
+ * @return None
+ */
+void pal_mmio_barrier(void)
+{
+	wmb();
+}
+
 uint64_t *pal_pa_to_va(uint64_t addr)
 {
 	uint64_t *va;
@@ -81,7 +233,12 @@ uint64_t *pal_pa_to_va(uint64_t addr)
 
 void pal_va_write(uint64_t *addr, uint32_t offset, uint32_t data)
 {
-	*(uint32_t *)((uint8_t *)addr + offset) = data;
+	writel(data, (uint8_t __iomem *)addr + offset);
+}
+
+void pal_va_write_relaxed(uint64_t *addr, uint32_t offset, uint32_t data)
+{
+	writel_relaxed(data, (uint8_t __iomem *)addr + offset);
 }
 
 void pal_va_free(uint64_t *addr)
@@ -89,7 +246,7 @@ void pal_va_free(uint64_t *addr)
 	iounmap(addr);
 }
 
-void pal_print(uint32_t verbosity, char *string, ...)
+void (pal_print)(uint32_t verbosity, char *string, ...)
 {
 	if (verbosity <= g_log_control.print_level) {
 		char buf[sizeof(pal_msg_parms_t)], *tmp=NULL;
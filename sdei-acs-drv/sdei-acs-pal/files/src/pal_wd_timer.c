@@ -261,8 +261,10 @@ void pal_wd_set_ws0(uint64_t *vaddr, uint64_t base, uint32_t index, uint32_t tim
 		return;
 	}
 
-	pal_va_write(vaddr,  WD_REG_CTRL, timeout);
-	pal_va_write(vaddr, WD_REG_BASE, WD_ENABLE);
+	/* Timeout and enable go out back to back behind a single barrier */
+	pal_mmio_barrier();
+	pal_va_write_relaxed(vaddr,  WD_REG_CTRL, timeout);
+	pal_va_write_relaxed(vaddr, WD_REG_BASE, WD_ENABLE);
 }
 
 void pal_generate_second_interrupt(uint32_t index, uint32_t timeout)
@@ -270,8 +272,9 @@ void pal_generate_second_interrupt(uint32_t index, uint32_t timeout)
 	uint64_t cnt_base_n;
 
 	cnt_base_n = pal_timer_get_info(TIMER_INFO_SYS_CNT_BASE_N, index);
-	pal_mmio_write(cnt_base_n + 0x28, timeout);
-	pal_mmio_write(cnt_base_n + 0x2C, 1);
+	pal_mmio_barrier();
+	pal_mmio_write_relaxed(cnt_base_n + 0x28, timeout);
+	pal_mmio_write_relaxed(cnt_base_n + 0x2C, 1);
 }
 
 void pal_disable_second_interrupt(uint32_t index)